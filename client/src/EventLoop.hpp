@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// periodic timer backed by a timerfd so it can be multiplexed with epoll.
+class TimerFD {
+private:
+  int _fd = -1;
+
+  std::chrono::nanoseconds _interval;
+  std::chrono::steady_clock::time_point _next_expiry;
+
+public:
+  TimerFD() {
+    _fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  }
+
+  ~TimerFD() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+  }
+
+  TimerFD(const TimerFD&) = delete;
+  TimerFD& operator=(const TimerFD&) = delete;
+
+  inline int fd() const {
+    return _fd;
+  }
+
+  // arms the timer on absolute deadlines so the period does not drift with handler runtime
+  bool start(std::chrono::nanoseconds interval) {
+    _interval = interval;
+    _next_expiry = std::chrono::steady_clock::now() + interval;
+
+    auto first = _next_expiry.time_since_epoch();
+    itimerspec spec{};
+    spec.it_interval.tv_sec = interval.count() / 1'000'000'000;
+    spec.it_interval.tv_nsec = interval.count() % 1'000'000'000;
+    spec.it_value.tv_sec = first.count() / 1'000'000'000;
+    spec.it_value.tv_nsec = first.count() % 1'000'000'000;
+    return timerfd_settime(_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0;
+  }
+
+  // arms the timer to expire once at deadline, replacing any pending expiry
+  bool startAt(std::chrono::steady_clock::time_point deadline) {
+    _interval = {};
+    _next_expiry = deadline;
+
+    auto first = std::max<std::chrono::nanoseconds>(deadline.time_since_epoch(), std::chrono::nanoseconds{1});
+    itimerspec spec{};
+    spec.it_value.tv_sec = first.count() / 1'000'000'000;
+    spec.it_value.tv_nsec = first.count() % 1'000'000'000;
+    return timerfd_settime(_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0;
+  }
+
+  // returns the number of expirations since the last call (0 if spurious)
+  uint64_t consume() {
+    uint64_t expirations = 0;
+    if (::read(_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+      return 0;
+    }
+    _next_expiry += _interval * expirations;
+    return expirations;
+  }
+
+  // the deadline of the most recently consumed expiration
+  inline std::chrono::steady_clock::time_point lastExpiry() const {
+    return _next_expiry - _interval;
+  }
+};
+
+// counter based wakeup handle, safe to signal from any thread.
+class EventFD {
+private:
+  int _fd = -1;
+
+public:
+  EventFD() {
+    _fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+
+  ~EventFD() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+  }
+
+  EventFD(const EventFD&) = delete;
+  EventFD& operator=(const EventFD&) = delete;
+
+  inline int fd() const {
+    return _fd;
+  }
+
+  inline void signal() {
+    uint64_t one = 1;
+    [[maybe_unused]] auto _ = ::write(_fd, &one, sizeof(one));
+  }
+
+  inline uint64_t consume() {
+    uint64_t value = 0;
+    [[maybe_unused]] auto _ = ::read(_fd, &value, sizeof(value));
+    return value;
+  }
+};
+
+// minimal epoll reactor. handlers run on the thread calling run().
+class EventLoop {
+public:
+  using Handler = std::function<void(uint32_t events)>;
+
+private:
+  int _epoll_fd = -1;
+
+  std::unordered_map<int, std::shared_ptr<Handler>> _handlers;
+
+  bool _running = false;
+
+  uint64_t _wakeups = 0;
+
+public:
+  EventLoop() {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  }
+
+  ~EventLoop() {
+    if (_epoll_fd >= 0) {
+      ::close(_epoll_fd);
+    }
+  }
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  bool add(int fd, uint32_t events, Handler&& handler) {
+    if (fd < 0) {
+      return false;
+    }
+
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      return false;
+    }
+
+    _handlers[fd] = std::make_shared<Handler>(std::move(handler));
+    return true;
+  }
+
+  void remove(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    _handlers.erase(fd);
+  }
+
+  inline uint64_t wakeups() const {
+    return _wakeups;
+  }
+
+  inline void stop() {
+    _running = false;
+  }
+
+  void run() {
+    std::array<epoll_event, 16> events;
+
+    _running = true;
+    while (_running) {
+      auto count = epoll_wait(_epoll_fd, events.data(), events.size(), -1);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+
+      _wakeups++;
+
+      for (int i = 0; i < count && _running; i++) {
+        auto it = _handlers.find(events[i].data.fd);
+        if (it != _handlers.end()) {
+          // keep the handler alive in case it removes itself
+          auto handler = it->second;
+          (*handler)(events[i].events);
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+// log-linear histogram (16 linear buckets per power of two) over microseconds.
+// recording is a couple of instructions and never allocates.
+class LatencyHistogram {
+private:
+  static constexpr uint32_t SUB_BUCKET_BITS = 4;
+  static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static constexpr uint32_t BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  std::array<uint32_t, BUCKETS> _buckets = {0};
+
+  uint32_t _count = 0;
+  uint32_t _min = UINT32_MAX;
+  uint32_t _max = 0;
+  uint64_t _sum = 0;
+
+  static constexpr uint32_t indexOf(uint32_t value) {
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+    auto msb = std::bit_width(value) - 1;
+    auto sub = (value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+  }
+
+  static constexpr uint32_t valueOf(uint32_t index) {
+    if (index < SUB_BUCKETS) {
+      return index;
+    }
+    auto msb = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    auto sub = index % SUB_BUCKETS;
+    return (1u << msb) | (sub << (msb - SUB_BUCKET_BITS));
+  }
+
+public:
+  inline void record(uint32_t value_us) {
+    _buckets[indexOf(value_us)]++;
+    _count++;
+    _sum += value_us;
+    _min = std::min(_min, value_us);
+    _max = std::max(_max, value_us);
+  }
+
+  template <typename Rep, typename Period>
+  inline void record(std::chrono::duration<Rep, Period> value) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(value).count();
+    record((uint32_t)std::clamp<int64_t>(us, 0, UINT32_MAX));
+  }
+
+  uint32_t percentile(double p) const {
+    if (!_count) {
+      return 0;
+    }
+    auto rank = (uint64_t)(p / 100.0 * (_count - 1)) + 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < BUCKETS; i++) {
+      seen += _buckets[i];
+      if (seen >= rank) {
+        return std::clamp(valueOf(i), _min, _max);
+      }
+    }
+    return _max;
+  }
+
+  inline uint32_t count() const {
+    return _count;
+  }
+
+  inline uint32_t min() const {
+    return _count ? _min : 0;
+  }
+
+  inline uint32_t max() const {
+    return _max;
+  }
+
+  inline uint32_t mean() const {
+    return _count ? (uint32_t)(_sum / _count) : 0;
+  }
+
+  // adds the samples of another histogram, for totals over several report windows
+  void merge(const LatencyHistogram& other) {
+    for (uint32_t i = 0; i < BUCKETS; i++) {
+      _buckets[i] += other._buckets[i];
+    }
+    _count += other._count;
+    _sum += other._sum;
+    _min = std::min(_min, other._min);
+    _max = std::max(_max, other._max);
+  }
+
+  void reset() {
+    *this = {};
+  }
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// wait-free single-producer/single-consumer slot that only keeps the newest value (a triple buffer).
+// publish() may only be called from one thread and take() from one other thread. the writer never waits,
+// values the reader did not take in time are overwritten, and neither side ever touches the buffer the other uses.
+template <typename T>
+class LatestValue {
+private:
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+  // set in _middle while it holds a value the reader has not taken yet
+  static constexpr uint8_t FRESH = 4;
+
+  struct alignas(CACHE_LINE_SIZE) Slot {
+    T value;
+  };
+
+  std::array<Slot, 3> _slots = {};
+  // index of the slot between the two sides, plus FRESH
+  alignas(CACHE_LINE_SIZE) std::atomic<uint8_t> _middle = 2;
+  // producer side
+  alignas(CACHE_LINE_SIZE) uint8_t _write = 0;
+  // consumer side
+  alignas(CACHE_LINE_SIZE) uint8_t _read = 1;
+
+public:
+  inline void publish(const T& value) {
+    _slots[_write].value = value;
+    _write = _middle.exchange(_write | FRESH, std::memory_order_acq_rel) & ~FRESH;
+  }
+
+  // returns false if nothing was published since the last take()
+  inline bool take(T& value) {
+    if (!(_middle.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    _read = _middle.exchange(_read, std::memory_order_acq_rel) & ~FRESH;
+    value = _slots[_read].value;
+    return true;
+  }
+};
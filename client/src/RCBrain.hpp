@@ -0,0 +1,524 @@
+#pragma once
+
+#include "EventLoop.hpp"
+#include "LatencyHistogram.hpp"
+#include "RCTransport.hpp"
+#include "SPSCQueue.hpp"
+#include "rc-framing.hpp"
+#include "rc-messages.hpp"
+#include "rc-protocol.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+
+enum RCLatencyClass {
+  // arm button presses and parameter writes, sent the moment they are queued
+  LATENCY_URGENT,
+  // stick state and pings, only the newest value per axis is sent with the next tick
+  LATENCY_COALESCED,
+  // parameter reads, batched and sent with the next tick
+  LATENCY_BULK,
+  LATENCY_CLASS_COUNT,
+};
+
+enum RCLinkState : uint8_t {
+  // no hello from the bridge yet, it is assumed to speak our version
+  LINK_UNKNOWN,
+  LINK_COMPATIBLE,
+  // the bridge's protocol version range does not overlap ours, nothing but hellos is sent
+  LINK_INCOMPATIBLE,
+};
+
+struct RCBrainStats {
+  struct LatencyClassStats {
+    // time between write() on the input side and the event hitting the serial device
+    LatencyHistogram wait;
+
+    uint64_t events = 0;
+    // number of serial writes that carried events of this class
+    uint64_t flushes = 0;
+    // events replaced by a newer one before they were sent
+    uint64_t coalesced = 0;
+  };
+
+  LatencyClassStats classes[LATENCY_CLASS_COUNT];
+
+  uint64_t events = 0;
+  uint64_t writes = 0;
+  // writes the transport did not take, e.g. a full socket buffer
+  uint64_t write_errors = 0;
+  // events the bridge does not accept, dropped instead of sent
+  uint64_t unsupported = 0;
+
+  // time from reconnect() to the first write on the reopened device
+  LatencyHistogram reconnect;
+  uint64_t reconnects = 0;
+
+  // adds the counts of another window, for totals over several reports
+  void merge(const RCBrainStats& other) {
+    for (int i = 0; i < LATENCY_CLASS_COUNT; i++) {
+      classes[i].wait.merge(other.classes[i].wait);
+      classes[i].events += other.classes[i].events;
+      classes[i].flushes += other.classes[i].flushes;
+      classes[i].coalesced += other.classes[i].coalesced;
+    }
+    events += other.events;
+    writes += other.writes;
+    write_errors += other.write_errors;
+    unsupported += other.unsupported;
+    reconnect.merge(other.reconnect);
+    reconnects += other.reconnects;
+  }
+};
+
+// write() is the producer side and may be called from the input handling thread only.
+// send()/sendUrgent() are the serial writer side and may be called from the transmit thread only.
+class RCBrain {
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct QueuedEvent {
+    rc::GamepadEvent gamepad_event;
+    clock::rep enqueued_at;
+  };
+
+  // coalescing slots, one per axis for AXIS_MOTION, one each for PAD_EVENT_CHANNELS and PAD_EVENT_CRSF_CHANNELS
+  // and one for PAD_EVENT_PING, which goes out last
+  static constexpr auto CHANNELS_SLOT = rc::SDL_GAMEPAD_AXIS_COUNT;
+  static constexpr auto CRSF_CHANNELS_SLOT = CHANNELS_SLOT + 1;
+  static constexpr auto PING_SLOT = CRSF_CHANNELS_SLOT + 1;
+
+  // a bridge that is still booting misses the first hello
+  static constexpr auto HELLO_RETRY = std::chrono::milliseconds{500};
+  static constexpr uint8_t HELLO_ATTEMPTS = 6;
+
+  std::unique_ptr<RCTransport> _transport;
+  // set by reconnect() (clock ns), taken by the first flush() on the new device
+  std::atomic<clock::rep> _reconnect_started = 0;
+
+  SPSCQueue<QueuedEvent, 256> _queue;
+  std::atomic<uint64_t> _dropped = 0;
+
+  // signalled by write() for urgent events so the transmit thread flushes right away
+  EventFD _urgent;
+
+  std::array<std::optional<QueuedEvent>, PING_SLOT + 1> _coalesced;
+  std::array<QueuedEvent, 32> _bulk;
+  uint8_t _bulk_len = 0;
+
+  std::array<uint8_t, rc::CDC_PACKET_SIZE> _buffer;
+  uint8_t _buffer_len = 0;
+
+  struct BufferedEvent {
+    RCLatencyClass latency_class;
+    clock::rep enqueued_at;
+  };
+  std::array<BufferedEvent, rc::CDC_PACKET_SIZE / rc::FRAME_OVERHEAD> _buffer_events;
+  uint8_t _buffer_events_len = 0;
+
+  RCBrainStats _stats;
+
+  // set by open()/reconnect() and by a hello from the bridge asking for ours, taken by the transmit thread
+  std::atomic<bool> _hello_request = false;
+  std::atomic<bool> _hello_answer = false;
+  clock::rep _hello_sent_at = 0;
+  uint8_t _hello_attempts = 0;
+
+  // negotiated from the bridge's hello by the reading thread, used by the transmit thread to pick encodings
+  std::atomic<RCLinkState> _link_state = LINK_UNKNOWN;
+  std::atomic<uint32_t> _peer_events = 0;
+  std::atomic<uint32_t> _peer_features = 0;
+  std::atomic<uint8_t> _peer_max_payload = 0;
+  // reading thread only
+  rc::Hello _peer = {};
+
+  rc::FrameDecoder _decoder;
+  // filled by RCTransport::readAvailable(), head and tail run freely and wrap on the ring size
+  std::array<uint8_t, 256> _read_buffer;
+  unsigned int _read_head = 0;
+  unsigned int _read_tail = 0;
+
+  static RCLatencyClass latencyClassOf(const rc::GamepadEvent& gamepad_event) {
+    switch (gamepad_event.type) {
+    case rc::GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION:
+    case rc::GamepadEvent::PAD_EVENT_CHANNELS:
+    case rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS:
+    case rc::GamepadEvent::PAD_EVENT_PING:
+      return LATENCY_COALESCED;
+    case rc::GamepadEvent::PAD_EVENT_GET_PARAMETER:
+    case rc::GamepadEvent::PAD_EVENT_READ_PARAMETER_ENTRIES:
+      return LATENCY_BULK;
+    default:
+      return LATENCY_URGENT;
+    }
+  }
+
+  static rc::Hello localHello(uint8_t flags) {
+    return {rc::PROTOCOL_VERSION, rc::PROTOCOL_MIN_VERSION, rc::FRAME_MAX_PAYLOAD_SIZE, flags, rc::RemoteMessages::acceptedEvents(), rc::FEATURE_BATCHING};
+  }
+
+  // what a bridge that has not answered yet is assumed to accept: everything we send, as before the hello existed
+  void resetLink() {
+    _peer = {};
+    _peer_events.store(rc::GamepadMessages::acceptedEvents(), std::memory_order_relaxed);
+    _peer_features.store(rc::FEATURE_BATCHING, std::memory_order_relaxed);
+    _peer_max_payload.store(rc::FRAME_MAX_PAYLOAD_SIZE, std::memory_order_relaxed);
+    _link_state.store(LINK_UNKNOWN, std::memory_order_release);
+    _hello_request.store(true, std::memory_order_relaxed);
+    _urgent.signal();
+  }
+
+  void negotiate(const rc::Hello& peer) {
+    auto local = localHello(0);
+    auto compatible = rc::compatible(local, peer);
+
+    _peer = peer;
+    _peer_events.store(compatible ? peer.accepted_events : 0, std::memory_order_relaxed);
+    _peer_features.store(peer.features & local.features, std::memory_order_relaxed);
+    _peer_max_payload.store(peer.max_payload, std::memory_order_relaxed);
+    _link_state.store(compatible ? LINK_COMPATIBLE : LINK_INCOMPATIBLE, std::memory_order_release);
+
+    if (peer.flags & rc::HELLO_REQUEST) {
+      _hello_answer.store(true, std::memory_order_relaxed);
+      _urgent.signal();
+    }
+
+    if (!compatible) {
+      printf("bridge: incompatible protocol v%u..v%u (ours v%u..v%u), not sending anything\n",
+        peer.min_version, peer.version, local.min_version, local.version);
+      return;
+    }
+    printf("bridge: protocol v%u, %s, %s, max payload %u\n",
+      std::min(peer.version, local.version),
+      peer.accepted_events & rc::eventBit(rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS) ? "shaped channels" :
+      peer.accepted_events & rc::eventBit(rc::GamepadEvent::PAD_EVENT_CHANNELS)      ? "packed channels" : "per axis channels",
+      _peer_features.load(std::memory_order_relaxed) & rc::FEATURE_BATCHING ? "batched" : "one frame per write",
+      peer.max_payload);
+  }
+
+  // hellos go out ahead of everything else in the packet
+  void sendHello() {
+    auto now = clock::now().time_since_epoch().count();
+
+    auto request = _hello_request.exchange(false, std::memory_order_relaxed);
+    if (request) {
+      _hello_attempts = 0;
+    } else if (_hello_attempts && _link_state.load(std::memory_order_acquire) == LINK_UNKNOWN && clock::duration{now - _hello_sent_at} > HELLO_RETRY) {
+      if (_hello_attempts < HELLO_ATTEMPTS) {
+        request = true;
+      } else if (_hello_attempts == HELLO_ATTEMPTS) {
+        printf("bridge: no answer to hello, assuming protocol v%u\n", rc::PROTOCOL_VERSION);
+        _hello_attempts++;
+      }
+    }
+
+    auto answer = _hello_answer.exchange(false, std::memory_order_relaxed);
+    if (!request && !answer) {
+      return;
+    }
+
+    auto hello = localHello(request ? rc::HELLO_REQUEST : 0);
+    if (_buffer_len + sizeof(hello) + rc::FRAME_OVERHEAD > _buffer.size()) {
+      flush();
+    }
+    _buffer_len += rc::encodeFrame(rc::FRAME_HELLO, hello, &_buffer[_buffer_len]);
+
+    if (request) {
+      _hello_sent_at = now;
+      _hello_attempts++;
+    }
+  }
+
+  inline void append(const QueuedEvent& queued, RCLatencyClass latency_class) {
+    auto size = rc::GamepadMessages::sizeOf(queued.gamepad_event.type);
+    if (!(_peer_events.load(std::memory_order_relaxed) & rc::eventBit(queued.gamepad_event.type)) ||
+        size > _peer_max_payload.load(std::memory_order_relaxed)) {
+      _stats.unsupported++;
+      return;
+    }
+
+    if ((size_t)_buffer_len + size + rc::FRAME_OVERHEAD > _buffer.size()) {
+      flush();
+    }
+
+    _buffer_len += rc::GamepadMessages::encode(queued.gamepad_event, &_buffer[_buffer_len]);
+    _buffer_events[_buffer_events_len++] = {latency_class, queued.enqueued_at};
+
+    if (!(_peer_features.load(std::memory_order_relaxed) & rc::FEATURE_BATCHING)) {
+      flush();
+    }
+  }
+
+  inline void flush() {
+    if (!_buffer_len) {
+      return;
+    }
+
+    if (!_transport->write(_buffer.data(), _buffer_len)) {
+      _stats.write_errors++;
+    }
+
+    auto written_at = clock::now().time_since_epoch().count();
+    if (_reconnect_started.load(std::memory_order_relaxed)) {
+      if (auto started = _reconnect_started.exchange(0, std::memory_order_relaxed)) {
+        _stats.reconnect.record(clock::duration{written_at - started});
+        _stats.reconnects++;
+      }
+    }
+
+    bool flushed[LATENCY_CLASS_COUNT] = {false};
+    for (uint8_t i = 0; i < _buffer_events_len; i++) {
+      auto& event = _buffer_events[i];
+      auto& class_stats = _stats.classes[event.latency_class];
+      class_stats.wait.record(clock::duration{written_at - event.enqueued_at});
+      class_stats.events++;
+      if (!flushed[event.latency_class]) {
+        flushed[event.latency_class] = true;
+        class_stats.flushes++;
+      }
+    }
+
+    _stats.events += _buffer_events_len;
+    _stats.writes++;
+    _buffer_len = 0;
+    _buffer_events_len = 0;
+  }
+
+  inline void coalesce(const QueuedEvent& queued) {
+    uint8_t slot;
+    switch (queued.gamepad_event.type) {
+    case rc::GamepadEvent::PAD_EVENT_CHANNELS:
+      slot = CHANNELS_SLOT;
+      break;
+    case rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS:
+      slot = CRSF_CHANNELS_SLOT;
+      break;
+    case rc::GamepadEvent::PAD_EVENT_PING:
+      slot = PING_SLOT;
+      break;
+    default:
+      slot = std::min<uint8_t>(queued.gamepad_event.axis_motion.axis, CHANNELS_SLOT - 1);
+      break;
+    }
+    if (_coalesced[slot]) {
+      _stats.classes[LATENCY_COALESCED].coalesced++;
+    }
+    _coalesced[slot] = queued;
+  }
+
+  // urgent events go straight into the output buffer, the rest is parked until the next tick
+  void collect() {
+    sendHello();
+
+    _queue.drain([&](const QueuedEvent& queued) {
+      switch (latencyClassOf(queued.gamepad_event)) {
+      case LATENCY_URGENT:
+        append(queued, LATENCY_URGENT);
+        break;
+      case LATENCY_COALESCED:
+        coalesce(queued);
+        break;
+      case LATENCY_BULK:
+        if (_bulk_len == _bulk.size()) {
+          flushBulk();
+        }
+        _bulk[_bulk_len++] = queued;
+        break;
+      case LATENCY_CLASS_COUNT:
+        break;
+      }
+    });
+  }
+
+  void flushBulk() {
+    for (uint8_t i = 0; i < _bulk_len; i++) {
+      append(_bulk[i], LATENCY_BULK);
+    }
+    _bulk_len = 0;
+  }
+
+public:
+  // reconnect() has this long to get channel output going again on the new device
+  static constexpr auto RECONNECT_BUDGET = std::chrono::milliseconds{20};
+
+  // must be called before the transmit thread is started.
+  // fd() is valid afterwards even if the bridge was not found, see disconnect()
+  bool open(std::unique_ptr<RCTransport> transport) {
+    _transport = std::move(transport);
+    resetLink();
+    return _transport->open();
+  }
+
+  inline RCTransport& transport() {
+    return *_transport;
+  }
+
+  // keeps the descriptor valid with nothing behind it, so the transmit thread writes into the void until reconnect()
+  void disconnect() {
+    _transport->disconnect();
+  }
+
+  // reopens the bridge in place, the transmit thread picks it up with its next write
+  bool reconnect() {
+    auto started = clock::now();
+    if (!_transport->reconnect()) {
+      return false;
+    }
+
+    _decoder = {};
+    _read_head = _read_tail = 0;
+    // the firmware may have been flashed in between
+    resetLink();
+    _reconnect_started.store(started.time_since_epoch().count(), std::memory_order_relaxed);
+    return true;
+  }
+
+  inline bool connected() const {
+    return _transport->connected();
+  }
+
+  inline bool write(const rc::GamepadEvent& gamepad_event) {
+    if (!_queue.push({gamepad_event, clock::now().time_since_epoch().count()})) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    if (latencyClassOf(gamepad_event) == LATENCY_URGENT) {
+      _urgent.signal();
+    }
+    return true;
+  }
+
+  // readable when urgent events are waiting for sendUrgent()
+  inline int urgentFD() const {
+    return _urgent.fd();
+  }
+
+  // sends urgent events right away, everything else stays parked for the next send()
+  void sendUrgent() {
+    _urgent.consume();
+    collect();
+    flush();
+  }
+
+  // called once per channel tick: sends everything queued by write() together with the given channel events
+  void send(std::span<const rc::GamepadEvent> channels = {}) {
+    collect();
+
+    auto now = clock::now().time_since_epoch().count();
+    auto peer_events = _peer_events.load(std::memory_order_relaxed);
+    auto shaped_channels = peer_events & rc::eventBit(rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS);
+    auto packed_channels = peer_events & rc::eventBit(rc::GamepadEvent::PAD_EVENT_CHANNELS);
+    bool has_shaped = false;
+    for (auto& gamepad_event : channels) {
+      has_shaped |= gamepad_event.type == rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS;
+    }
+    for (auto& gamepad_event : channels) {
+      if (gamepad_event.type == rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS && !shaped_channels) {
+        continue;
+      }
+      // the bridge maps the raw axes only when it does not get them shaped
+      if (gamepad_event.type == rc::GamepadEvent::PAD_EVENT_CHANNELS && has_shaped && shaped_channels) {
+        continue;
+      }
+      if (gamepad_event.type == rc::GamepadEvent::PAD_EVENT_CHANNELS && !packed_channels) {
+        // a bridge without PAD_EVENT_CHANNELS still gets the sticks, one AXIS_MOTION event each
+        for (uint8_t axis = 0; axis < rc::SDL_GAMEPAD_AXIS_COUNT; axis++) {
+          coalesce({rc::msg::AxisMotion::make({axis, gamepad_event.channels.axes[axis]}), now});
+        }
+        continue;
+      }
+      coalesce({gamepad_event, now});
+    }
+
+    for (auto& slot : _coalesced) {
+      if (slot) {
+        append(*slot, LATENCY_COALESCED);
+        slot.reset();
+      }
+    }
+
+    flushBulk();
+    flush();
+  }
+
+  // reads whatever is pending and calls on_event for every complete RemoteEvent frame, hellos are handled here
+  template <typename F>
+  void read(rc::RemoteEvent& remote_event, F&& on_event) {
+    while (_transport->readAvailable(_read_buffer.data(), _read_buffer.size(), &_read_head, _read_tail) > 0) {
+      for (; _read_tail != _read_head; _read_tail++) {
+        if (!_decoder.push(_read_buffer[_read_tail % _read_buffer.size()])) {
+          continue;
+        }
+
+        switch (_decoder.type()) {
+        case rc::FRAME_REMOTE_EVENT:
+          if (rc::RemoteMessages::decode(_decoder.payload(), _decoder.payloadSize(), remote_event)) {
+            on_event();
+          }
+          break;
+        case rc::FRAME_HELLO: {
+          rc::Hello hello;
+          if (_decoder.payloadAs(hello)) {
+            negotiate(hello);
+          }
+        } break;
+        }
+      }
+    }
+  }
+
+  inline RCLinkState linkState() const {
+    return _link_state.load(std::memory_order_acquire);
+  }
+
+  // the bridge's hello, zero until it answered. reading thread only
+  inline const rc::Hello& peer() const {
+    return _peer;
+  }
+
+  inline const rc::FrameDecoder::Stats& decoderStats() const {
+    return _decoder.stats();
+  }
+
+  inline int fd() const {
+    return _transport->fd();
+  }
+
+  inline uint64_t dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  // serial writer side only
+  RCBrainStats takeStats() {
+    auto stats = _stats;
+    _stats = {};
+    return stats;
+  }
+
+  void getParameter(uint8_t parameter) {
+    write(rc::msg::GetParameter::make({parameter}));
+  }
+
+  void setParameter(uint8_t parameter, uint8_t value) {
+    write(rc::msg::SetParameter::make({parameter, value}));
+  }
+
+  // whole entries, in as few events as possible
+  void readParameterEntries(std::span<const uint8_t> parameters) {
+    while (!parameters.empty()) {
+      rc::msg::ReadParameterEntries::payload_type read{};
+      read.count = std::min<size_t>(parameters.size(), rc::PARAMETER_ENTRIES_PER_READ);
+      std::copy_n(parameters.begin(), read.count, read.parameters);
+      write(rc::msg::ReadParameterEntries::make(read));
+      parameters = parameters.subspan(read.count);
+    }
+  }
+};
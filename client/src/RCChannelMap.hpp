@@ -0,0 +1,233 @@
+#pragma once
+
+#include "RCInputShaping.hpp"
+#include "crsf-structs.hpp"
+#include "rc-protocol.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+// a switch on a crsf channel, driven by one button or several held together
+struct RCButtonRule {
+  enum Mode : uint8_t {
+    // high while held
+    MOMENTARY,
+    // flips on every press
+    TOGGLE,
+    // low, middle, high, low... on every press
+    THREE_POSITION,
+  };
+
+  uint32_t buttons = 0; // bit n = SDL_GamepadButton n, all of them held at once. 0 = no rule
+  Mode mode = MOMENTARY;
+};
+
+// which axis or button drives each of the 16 crsf channels, read from input.cfg:
+//   lefty.expo=0.3                  axis shapes, see RCInputShaping
+//   left_trigger.channel=6
+//   channel5.buttons=left_paddle1   1..16 as radios count them
+//   channel7.buttons=back+start
+//   channel7.mode=three_position    momentary (default), toggle or three_position
+// compiled into two flat term lists that evaluate() runs through once per input tick without branching on the
+// kind of rule. a channel with both an axis and a button rule follows the buttons, so the axis terms alone can be
+// evaluated again on fresher sticks (see RCTransmitter::setSampler()).
+class RCChannelMap {
+public:
+  static constexpr std::string_view BUTTON_NAMES[rc::SDL_GAMEPAD_BUTTON_COUNT] = {
+    "south", "east", "west", "north", "back", "guide", "start", "left_stick", "right_stick",
+    "left_shoulder", "right_shoulder", "dpad_up", "dpad_down", "dpad_left", "dpad_right", "misc1",
+    "right_paddle1", "left_paddle1", "right_paddle2", "left_paddle2", "touchpad",
+    "misc2", "misc3", "misc4", "misc5", "misc6",
+  };
+
+  static constexpr std::string_view MODE_NAMES[] = {"momentary", "toggle", "three_position"};
+
+private:
+  struct AxisTerm {
+    const uint16_t* table;
+    uint8_t axis;
+    uint8_t channel;
+  };
+
+  struct ButtonTerm {
+    uint32_t buttons;
+    uint16_t values[3]; // per position
+    uint8_t channel;
+    uint8_t follow; // 0xFF = the position is whether the buttons are held, 0 = it advances on every press
+    uint8_t positions;
+    uint8_t position;
+    uint8_t held;
+  };
+
+  RCInputShaping _shaping;
+  std::array<RCButtonRule, rc::CRSF_CHANNEL_COUNT> _rules = {};
+
+  std::array<AxisTerm, rc::SDL_GAMEPAD_AXIS_COUNT> _axis_terms;
+  uint8_t _axis_terms_len = 0;
+  std::array<ButtonTerm, rc::CRSF_CHANNEL_COUNT> _button_terms;
+  uint8_t _button_terms_len = 0;
+  uint16_t _mask = 0;
+  uint16_t _axis_mask = 0;
+
+  static bool parseButtons(std::string_view value, uint32_t& buttons) {
+    buttons = 0;
+    while (!value.empty()) {
+      auto plus = value.find('+');
+      auto name = value.substr(0, plus);
+      auto button = std::find(std::begin(BUTTON_NAMES), std::end(BUTTON_NAMES), name) - std::begin(BUTTON_NAMES);
+      if (button == rc::SDL_GAMEPAD_BUTTON_COUNT) {
+        return false;
+      }
+      buttons |= 1u << button;
+      value = plus == std::string_view::npos ? std::string_view{} : value.substr(plus + 1);
+    }
+    return buttons != 0;
+  }
+
+  // channelN.field=value
+  bool configure(std::string_view name, std::string_view field, std::string_view value) {
+    if (!name.starts_with("channel")) {
+      return _shaping.configure(name, field, value);
+    }
+
+    unsigned channel = 0;
+    auto number = name.substr(7);
+    if (std::from_chars(number.data(), number.data() + number.size(), channel).ec != std::errc{} ||
+        channel < 1 || channel > rc::CRSF_CHANNEL_COUNT) {
+      return false;
+    }
+    auto& rule = _rules[channel - 1];
+
+    if (field == "buttons") {
+      return parseButtons(value, rule.buttons);
+    }
+    if (field == "mode") {
+      auto mode = std::find(std::begin(MODE_NAMES), std::end(MODE_NAMES), value);
+      if (mode == std::end(MODE_NAMES)) {
+        return false;
+      }
+      rule.mode = (RCButtonRule::Mode)(mode - std::begin(MODE_NAMES));
+      return true;
+    }
+    return false;
+  }
+
+  void compile() {
+    _shaping.compile();
+    _mask = 0;
+    _axis_mask = 0;
+
+    _button_terms_len = 0;
+    for (uint8_t channel = 0; channel < rc::CRSF_CHANNEL_COUNT; channel++) {
+      auto& rule = _rules[channel];
+      if (!rule.buttons) {
+        continue;
+      }
+      if (_shaping.mask() & (1u << channel)) {
+        printf("input mapping: channel %u has an axis and buttons, it follows the buttons\n", channel + 1);
+      }
+
+      auto& term = _button_terms[_button_terms_len++];
+      term = {rule.buttons, {crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX, crsf::CHANNEL_VALUE_MAX}, channel, 0, 2, 0, 0};
+      switch (rule.mode) {
+      case RCButtonRule::MOMENTARY:
+        term.follow = 0xFF;
+        break;
+      case RCButtonRule::TOGGLE:
+        break;
+      case RCButtonRule::THREE_POSITION:
+        term.values[1] = crsf::CHANNEL_VALUE_MID;
+        term.positions = 3;
+        break;
+      }
+      _mask |= 1u << channel;
+    }
+
+    _axis_terms_len = 0;
+    for (uint8_t axis = 0; axis < rc::SDL_GAMEPAD_AXIS_COUNT; axis++) {
+      auto channel = _shaping.channel(axis);
+      if (channel == RCAxisShape::NO_CHANNEL || (_mask & (1u << channel))) {
+        continue;
+      }
+      _axis_terms[_axis_terms_len++] = {_shaping.table(axis), axis, channel};
+      _axis_mask |= 1u << channel;
+    }
+    _mask |= _axis_mask;
+  }
+
+public:
+  RCChannelMap() {
+    compile();
+  }
+
+  // replaces the mapping with the defaults plus the settings in the file, a missing file keeps the defaults
+  void loadFromFile(const std::filesystem::path& path) {
+    _shaping.reset();
+    _rules = {};
+
+    std::ifstream cfg_stream{path};
+    std::string line;
+    while (std::getline(cfg_stream, line)) {
+      if (line.empty() || line.starts_with('#')) {
+        continue;
+      }
+      auto dot = line.find('.');
+      auto separator = line.find('=');
+      if (dot == std::string::npos || separator == std::string::npos || separator < dot ||
+          !configure(std::string_view{line}.substr(0, dot), std::string_view{line}.substr(dot + 1, separator - dot - 1),
+            std::string_view{line}.substr(separator + 1))) {
+        printf("input mapping: ignoring '%s'\n", line.c_str());
+      }
+    }
+
+    compile();
+  }
+
+  inline const RCInputShaping& shaping() const {
+    return _shaping;
+  }
+
+  // bit n = crsf channel n is driven by the host
+  inline uint16_t mask() const {
+    return _mask;
+  }
+
+  // bit n = crsf channel n is driven by an axis and no buttons
+  inline uint16_t axisMask() const {
+    return _axis_mask;
+  }
+
+  // only the channels in axisMask(), stateless so any thread may call it once the map is loaded
+  inline void evaluateAxes(const std::array<int16_t, rc::SDL_GAMEPAD_AXIS_COUNT>& axes,
+    std::array<uint16_t, rc::CRSF_CHANNEL_COUNT>& values) const {
+    for (uint8_t i = 0; i < _axis_terms_len; i++) {
+      auto& term = _axis_terms[i];
+      values[term.channel] = term.table[axes[term.axis] - INT16_MIN];
+    }
+  }
+
+  // all mapped channels from the current input. held = buttons down now, pressed = buttons that went down since the
+  // last call, so a press and release within one tick still counts. channels outside mask() are left alone
+  void evaluate(const std::array<int16_t, rc::SDL_GAMEPAD_AXIS_COUNT>& axes, uint32_t held, uint32_t pressed,
+    std::array<uint16_t, rc::CRSF_CHANNEL_COUNT>& values) {
+    evaluateAxes(axes, values);
+
+    for (uint8_t i = 0; i < _button_terms_len; i++) {
+      auto& term = _button_terms[i];
+      uint8_t now = ((held | pressed) & term.buttons) == term.buttons;
+      // held since the last tick without being pressed again is no new press
+      uint8_t rising = now & ((term.held ^ 1) | ((pressed & term.buttons) != 0));
+      uint8_t advanced = term.position + rising;
+      advanced -= (advanced == term.positions) * term.positions;
+      term.position = (now & term.follow) | (advanced & ~term.follow);
+      term.held = now;
+      values[term.channel] = term.values[term.position];
+    }
+  }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// ntp style estimate of the firmware's micros() clock relative to the host steady_clock.
+// every ping/pong exchange gives one offset sample, only the exchanges with the shortest path delay
+// are trusted (queueing only ever adds delay) and a line through them gives offset and drift.
+class RCClockSync {
+private:
+  struct Sample {
+    // host time of the exchange midpoint
+    int64_t host_ns;
+    // firmware minus host clock
+    int64_t offset_ns;
+    int64_t delay_ns;
+  };
+
+  static constexpr size_t SAMPLE_COUNT = 64;
+  static constexpr size_t MIN_SAMPLES = 8;
+
+  std::array<Sample, SAMPLE_COUNT> _samples;
+  size_t _sample_count = 0;
+  size_t _sample_next = 0;
+
+  // micros() wraps every ~71 minutes, firmware times are unwrapped against the last one seen
+  bool _has_firmware_time = false;
+  uint32_t _last_firmware_us = 0;
+  int64_t _firmware_us = 0;
+
+  // offset_ns = _offset_ns + _drift * (host_ns - _reference_ns)
+  bool _synced = false;
+  int64_t _reference_ns = 0;
+  double _offset_ns = 0;
+  double _drift = 0;
+  int64_t _delay_ns = 0;
+
+  void fit() {
+    // the quarter of the window with the shortest path delay
+    std::array<int64_t, SAMPLE_COUNT> delays = {};
+    for (size_t i = 0; i < _sample_count; i++) {
+      delays[i] = _samples[i].delay_ns;
+    }
+    auto quartile = delays.begin() + _sample_count / 4;
+    std::nth_element(delays.begin(), quartile, delays.begin() + _sample_count);
+    auto max_delay = *quartile;
+
+    _reference_ns = _samples[(_sample_next + SAMPLE_COUNT - 1) % SAMPLE_COUNT].host_ns;
+
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < _sample_count; i++) {
+      auto& sample = _samples[i];
+      if (sample.delay_ns > max_delay) {
+        continue;
+      }
+      double x = sample.host_ns - _reference_ns;
+      double y = sample.offset_ns;
+      n++;
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+    }
+
+    auto denominator = n * sxx - sx * sx;
+    _drift = n > 1 && denominator != 0 ? (n * sxy - sx * sy) / denominator : 0;
+    _offset_ns = (sy - _drift * sx) / n;
+    _delay_ns = max_delay;
+    _synced = _sample_count >= MIN_SAMPLES;
+  }
+
+public:
+  // firmware micros() as a monotonic 64 bit count, call with firmware times in the order they were taken
+  int64_t unwrap(uint32_t firmware_us) {
+    if (!_has_firmware_time) {
+      _has_firmware_time = true;
+      _firmware_us = firmware_us;
+    } else {
+      _firmware_us += (int32_t)(firmware_us - _last_firmware_us);
+    }
+    _last_firmware_us = firmware_us;
+    return _firmware_us;
+  }
+
+  // t0/t3: host send and receive time, t1/t2: unwrapped firmware receive and reply time
+  void addExchange(int64_t t0_ns, int64_t t1_us, int64_t t2_us, int64_t t3_ns) {
+    auto t1_ns = t1_us * 1000;
+    auto t2_ns = t2_us * 1000;
+
+    auto& sample = _samples[_sample_next];
+    sample.host_ns = t0_ns + (t3_ns - t0_ns) / 2;
+    sample.offset_ns = ((t1_ns - t0_ns) + (t2_ns - t3_ns)) / 2;
+    sample.delay_ns = (t3_ns - t0_ns) - (t2_ns - t1_ns);
+
+    _sample_next = (_sample_next + 1) % SAMPLE_COUNT;
+    _sample_count = std::min(_sample_count + 1, SAMPLE_COUNT);
+    fit();
+  }
+
+  inline bool synced() const {
+    return _synced;
+  }
+
+  // firmware minus host clock at the given host time
+  inline int64_t offsetNs(int64_t host_ns) const {
+    return _offset_ns + _drift * (host_ns - _reference_ns);
+  }
+
+  // an unwrapped firmware time in host steady_clock ns
+  inline int64_t toHostNs(int64_t firmware_us) const {
+    auto firmware_ns = firmware_us * 1000;
+    // the offset is a function of host time, drift is tiny so one refinement step is plenty
+    return firmware_ns - offsetNs(firmware_ns - offsetNs(_reference_ns));
+  }
+
+  inline double driftPPM() const {
+    return _drift * 1e6;
+  }
+
+  // path delay of the exchanges the estimate is based on
+  inline std::chrono::nanoseconds delay() const {
+    return std::chrono::nanoseconds{_delay_ns};
+  }
+
+  inline std::chrono::nanoseconds offset() const {
+    return std::chrono::nanoseconds{(int64_t)_offset_ns};
+  }
+};
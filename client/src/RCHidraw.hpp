@@ -0,0 +1,442 @@
+#pragma once
+
+#include "EventLoop.hpp"
+#include "LatencyHistogram.hpp"
+#include "LatestValue.hpp"
+#include "RCInput.hpp"
+#include "rc-protocol.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <poll.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+// the whole gamepad as one report left it, in SDL's conventions so it diffs into the RCInputEvents SDL would deliver
+struct RCGamepadState {
+  std::array<int16_t, rc::SDL_GAMEPAD_AXIS_COUNT> axes = {};
+  uint32_t buttons = 0; // bit n = SDL_GamepadButton n
+  uint32_t sequence = 0; // report counter of the controller
+  int64_t read_at_ns = 0; // steady_clock
+
+  // calls emit(input) for every axis and button that changed since before
+  template <typename F>
+  void diff(const RCGamepadState& before, F&& emit) const {
+    for (uint8_t axis = 0; axis < axes.size(); axis++) {
+      if (axes[axis] != before.axes[axis]) {
+        emit(RCInputEvent{(uint64_t)read_at_ns, rc::GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION, axis, axes[axis]});
+      }
+    }
+    for (auto changed = buttons ^ before.buttons; changed; changed &= changed - 1) {
+      uint8_t button = __builtin_ctz(changed);
+      auto type = buttons & (1u << button) ? rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_DOWN : rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_UP;
+      emit(RCInputEvent{(uint64_t)read_at_ns, (uint16_t)type, button, 0});
+    }
+  }
+};
+
+// the Deck's built in controller as the kernel's hidraw hands out its reports, layout as in linux' hid-steam.c
+namespace steamdeck {
+constexpr uint16_t VENDOR_ID = 0x28DE;
+constexpr uint16_t PRODUCT_ID = 0x1205;
+constexpr size_t REPORT_SIZE = 64;
+constexpr uint8_t ID_CONTROLLER_DECK_STATE = 0x09;
+
+struct ButtonBit {
+  uint8_t byte;
+  uint8_t bit;
+  uint8_t button;
+};
+
+constexpr ButtonBit BUTTON_BITS[] = {
+  {8, 7, rc::SDL_GAMEPAD_BUTTON_SOUTH}, // A
+  {8, 5, rc::SDL_GAMEPAD_BUTTON_EAST}, // B
+  {8, 6, rc::SDL_GAMEPAD_BUTTON_WEST}, // X
+  {8, 4, rc::SDL_GAMEPAD_BUTTON_NORTH}, // Y
+  {8, 3, rc::SDL_GAMEPAD_BUTTON_LEFT_SHOULDER}, // L1
+  {8, 2, rc::SDL_GAMEPAD_BUTTON_RIGHT_SHOULDER}, // R1
+  {9, 0, rc::SDL_GAMEPAD_BUTTON_DPAD_UP},
+  {9, 1, rc::SDL_GAMEPAD_BUTTON_DPAD_RIGHT},
+  {9, 2, rc::SDL_GAMEPAD_BUTTON_DPAD_LEFT},
+  {9, 3, rc::SDL_GAMEPAD_BUTTON_DPAD_DOWN},
+  {9, 4, rc::SDL_GAMEPAD_BUTTON_BACK}, // view
+  {9, 5, rc::SDL_GAMEPAD_BUTTON_GUIDE}, // steam
+  {9, 6, rc::SDL_GAMEPAD_BUTTON_START}, // menu
+  {9, 7, rc::SDL_GAMEPAD_BUTTON_LEFT_PADDLE2}, // L5
+  {10, 0, rc::SDL_GAMEPAD_BUTTON_RIGHT_PADDLE2}, // R5
+  {10, 6, rc::SDL_GAMEPAD_BUTTON_LEFT_STICK}, // L3
+  {11, 2, rc::SDL_GAMEPAD_BUTTON_RIGHT_STICK}, // R3
+  {13, 1, rc::SDL_GAMEPAD_BUTTON_LEFT_PADDLE1}, // L4
+  {13, 2, rc::SDL_GAMEPAD_BUTTON_RIGHT_PADDLE1}, // R4
+  {14, 2, rc::SDL_GAMEPAD_BUTTON_MISC1}, // quick access
+};
+
+inline int16_t le16(std::span<const uint8_t> report, size_t offset) {
+  return (int16_t)(report[offset] | report[offset + 1] << 8);
+}
+
+// false if this is not a controller state report
+inline bool parseReport(std::span<const uint8_t> report, RCGamepadState& state) {
+  if (report.size() < REPORT_SIZE || report[0] != 0x01 || report[2] != ID_CONTROLLER_DECK_STATE) {
+    return false;
+  }
+
+  state.sequence = report[4] | report[5] << 8 | report[6] << 16 | (uint32_t)report[7] << 24;
+
+  uint32_t buttons = 0;
+  for (auto& bit : BUTTON_BITS) {
+    buttons |= (uint32_t)((report[bit.byte] >> bit.bit) & 1) << bit.button;
+  }
+  state.buttons = buttons;
+
+  // up is positive on the Deck and negative in SDL, ~ keeps both ends of the range
+  state.axes[rc::SDL_GAMEPAD_AXIS_LEFTX] = le16(report, 48);
+  state.axes[rc::SDL_GAMEPAD_AXIS_LEFTY] = ~le16(report, 50);
+  state.axes[rc::SDL_GAMEPAD_AXIS_RIGHTX] = le16(report, 52);
+  state.axes[rc::SDL_GAMEPAD_AXIS_RIGHTY] = ~le16(report, 54);
+  state.axes[rc::SDL_GAMEPAD_AXIS_LEFT_TRIGGER] = le16(report, 44);
+  state.axes[rc::SDL_GAMEPAD_AXIS_RIGHT_TRIGGER] = le16(report, 46);
+  return true;
+}
+
+// /dev/hidrawN of the controller interface, empty if there is no Deck controller
+inline std::string findHidraw() {
+  char hid_id[32];
+  snprintf(hid_id, sizeof(hid_id), "HID_ID=0003:%08X:%08X", VENDOR_ID, PRODUCT_ID);
+
+  std::string found;
+  std::error_code error;
+  for (auto& entry : std::filesystem::directory_iterator{"/sys/class/hidraw", error}) {
+    std::ifstream uevent{entry.path() / "device" / "uevent"};
+    bool matches = false;
+    bool controller = false;
+    std::string line;
+    while (std::getline(uevent, line)) {
+      matches |= line == hid_id;
+      // the keyboard and mouse of lizard mode are the other interfaces
+      controller |= line.starts_with("HID_PHYS=") && line.ends_with("input2");
+    }
+    if (matches && (controller || found.empty())) {
+      found = "/dev/" + entry.path().filename().string();
+    }
+    if (matches && controller) {
+      break;
+    }
+  }
+  return found;
+}
+} // namespace steamdeck
+
+// captures are a small header followed by the raw reports, each with the time it was read
+struct [[gnu::packed]] RCHidCaptureHeader {
+  static constexpr uint32_t MAGIC = 0x44485352; // "RSHD"
+  static constexpr uint16_t VERSION = 1;
+
+  uint32_t magic = MAGIC;
+  uint16_t version = VERSION;
+  uint16_t report_size = steamdeck::REPORT_SIZE;
+};
+
+struct [[gnu::packed]] RCHidCaptureRecord {
+  uint64_t read_at_ns;
+  uint8_t report[steamdeck::REPORT_SIZE];
+};
+
+struct RCHidrawStats {
+  uint64_t reports = 0;
+  // reports that were not controller state
+  uint64_t invalid = 0;
+  // reports the controller counted that never arrived
+  uint64_t lost = 0;
+  // time between two reports
+  LatencyHistogram interval;
+};
+
+// reads the Deck controller straight from hidraw on its own thread, at the full report rate and without the
+// SDL event queue in between. the newest state is published lock-free, the input tick takes it from there and
+// the transmit thread samples the sticks from a slot of its own right before each write.
+// a capture of earlier reports can stand in for the device, replayed with its original timing.
+class RCHidrawInput : public RCAxisSampler {
+private:
+  using clock = std::chrono::steady_clock;
+
+  int _fd = -1;
+  FILE* _replay = nullptr;
+  FILE* _capture = nullptr;
+
+  std::thread _thread;
+  std::atomic<bool> _running = false;
+  std::atomic<bool> _done = false;
+  EventFD _stop;
+  // signalled by the reading thread when the device went away, the main loop falls back to SDL then
+  EventFD _gone;
+  std::chrono::nanoseconds _cpu_time{};
+
+  LatestValue<RCGamepadState> _latest;
+  // a second reader needs a second slot
+  LatestValue<RCGamepadState> _sampled;
+
+  RCHidrawStats _stats;
+  // published every REPORTS_PER_PUBLISH reports, try_lock'ed so the reading thread never blocks on it
+  static constexpr uint64_t REPORTS_PER_PUBLISH = 250;
+  std::mutex _report_mutex;
+  RCHidrawStats _report;
+
+  RCGamepadState _state;
+  clock::time_point _last_read{};
+
+  void onReport(std::span<const uint8_t> report, clock::time_point read_at) {
+    if (_capture && report.size() == steamdeck::REPORT_SIZE) {
+      RCHidCaptureRecord record;
+      record.read_at_ns = read_at.time_since_epoch().count();
+      memcpy(record.report, report.data(), sizeof(record.report));
+      fwrite(&record, sizeof(record), 1, _capture);
+    }
+
+    auto sequence = _state.sequence;
+    if (!steamdeck::parseReport(report, _state)) {
+      _stats.invalid++;
+      return;
+    }
+    if (_last_read != clock::time_point{}) {
+      // a counter that jumps far or backwards is a controller that restarted, not lost reports
+      auto gap = _state.sequence - sequence;
+      _stats.lost += gap > 1 && gap < UINT16_MAX ? gap - 1 : 0;
+      _stats.interval.record(read_at - _last_read);
+    }
+    _stats.reports++;
+    _last_read = read_at;
+
+    _state.read_at_ns = read_at.time_since_epoch().count();
+    _latest.publish(_state);
+    _sampled.publish(_state);
+
+    if (_stats.reports % REPORTS_PER_PUBLISH == 0) {
+      std::unique_lock lock{_report_mutex, std::try_to_lock};
+      if (lock) {
+        publishStats();
+      }
+    }
+  }
+
+  // with _report_mutex held
+  void publishStats() {
+    _report.reports += _stats.reports;
+    _report.invalid += _stats.invalid;
+    _report.lost += _stats.lost;
+    _report.interval.merge(_stats.interval);
+    _stats = {};
+  }
+
+  void readDevice() {
+    pollfd pfds[] = {
+      {_fd, POLLIN, 0},
+      {_stop.fd(), POLLIN, 0},
+    };
+    uint8_t report[steamdeck::REPORT_SIZE];
+    while (_running.load(std::memory_order_relaxed)) {
+      if (poll(pfds, std::size(pfds), -1) <= 0 || pfds[1].revents) {
+        continue;
+      }
+      if (pfds[0].revents & (POLLHUP | POLLERR)) {
+        printf("hidraw: device gone\n");
+        // centered for both readers, neither picks up the last report after a reopen
+        _state = {};
+        _state.read_at_ns = clock::now().time_since_epoch().count();
+        _latest.publish(_state);
+        _sampled.publish(_state);
+        _gone.signal();
+        break;
+      }
+      auto len = ::read(_fd, report, sizeof(report));
+      if (len > 0) {
+        onReport({report, (size_t)len}, clock::now());
+      }
+    }
+  }
+
+  void readReplay() {
+    RCHidCaptureRecord record;
+    std::optional<uint64_t> first;
+    auto begin = clock::now();
+    while (_running.load(std::memory_order_relaxed) && fread(&record, sizeof(record), 1, _replay) == 1) {
+      if (!first) {
+        first = uint64_t{record.read_at_ns};
+      }
+
+      // waits out the original spacing of the reports, or until stop()
+      auto due = begin + std::chrono::nanoseconds{record.read_at_ns - *first};
+      auto wait = std::max(due - clock::now(), clock::duration{0});
+      auto seconds = std::chrono::duration_cast<std::chrono::seconds>(wait);
+      timespec timeout{(time_t)seconds.count(), (long)(wait - seconds).count()};
+      pollfd pfd{_stop.fd(), POLLIN, 0};
+      if (ppoll(&pfd, 1, &timeout, nullptr) > 0) {
+        break;
+      }
+
+      onReport(record.report, clock::now());
+    }
+    _done.store(true, std::memory_order_release);
+  }
+
+  void run() {
+    if (_replay) {
+      readReplay();
+    } else {
+      readDevice();
+    }
+
+    {
+      std::lock_guard lock{_report_mutex};
+      publishStats();
+    }
+
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    _cpu_time = std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+  }
+
+public:
+  ~RCHidrawInput() {
+    stop();
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+    if (_replay) {
+      fclose(_replay);
+    }
+    if (_capture) {
+      fclose(_capture);
+    }
+  }
+
+  // the Deck controller, found through sysfs unless a /dev/hidrawN is given
+  bool open(std::string_view device = {}) {
+    // reopened after the device was gone, nothing of the old one carries over
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+    _state = {};
+    _last_read = {};
+
+    auto path = device.empty() ? steamdeck::findHidraw() : std::string{device};
+    if (path.empty()) {
+      printf("hidraw: no steam deck controller (%04x:%04x)\n", steamdeck::VENDOR_ID, steamdeck::PRODUCT_ID);
+      return false;
+    }
+    _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0) {
+      printf("hidraw: failed to open %s: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+    printf("hidraw: reading %s\n", path.c_str());
+    return true;
+  }
+
+  // a capture written by capture() instead of the device
+  bool openReplay(std::string_view path) {
+    _replay = fopen(std::string{path}.c_str(), "rb");
+    if (!_replay) {
+      return false;
+    }
+    RCHidCaptureHeader header;
+    if (fread(&header, sizeof(header), 1, _replay) != 1 || header.magic != RCHidCaptureHeader::MAGIC ||
+        header.version != RCHidCaptureHeader::VERSION || header.report_size != steamdeck::REPORT_SIZE) {
+      fclose(_replay);
+      _replay = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  // writes every report as it was read, before parsing, so captures also hold what the parser rejected
+  bool capture(std::string_view path) {
+    _capture = fopen(std::string{path}.c_str(), "wb");
+    if (!_capture) {
+      return false;
+    }
+    RCHidCaptureHeader header;
+    fwrite(&header, sizeof(header), 1, _capture);
+    return true;
+  }
+
+  void start() {
+    if ((_fd < 0 && !_replay) || _running.exchange(true)) {
+      return;
+    }
+    _thread = std::thread{&RCHidrawInput::run, this};
+  }
+
+  void stop() {
+    _running = false;
+    _stop.signal();
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+    // a later start() would see the stop right away otherwise
+    _stop.consume();
+  }
+
+  // readable once the device went away, see consumeGone()
+  inline int goneFD() const {
+    return _gone.fd();
+  }
+
+  inline bool consumeGone() {
+    return _gone.consume() > 0;
+  }
+
+  // a replay played its last report
+  inline bool done() const {
+    return _done.load(std::memory_order_acquire);
+  }
+
+  // returns false if no report arrived since the last take()
+  inline bool take(RCGamepadState& state) {
+    return _latest.take(state);
+  }
+
+  // for the transmit thread, see RCTransmitter::setSampler()
+  bool sample(RCAxisSample& sample) override {
+    RCGamepadState state;
+    if (!_sampled.take(state)) {
+      return false;
+    }
+    sample.axes = state.axes;
+    sample.sampled_at_ns = state.read_at_ns;
+    return true;
+  }
+
+  // cpu time of the reading thread, after stop()
+  inline std::chrono::nanoseconds cpuTime() const {
+    return _cpu_time;
+  }
+
+  RCHidrawStats takeReport() {
+    std::lock_guard lock{_report_mutex};
+    auto report = _report;
+    _report = {};
+    return report;
+  }
+
+  void printReport() {
+    auto r = takeReport();
+    printf("hidraw: reports=%llu invalid=%llu lost=%llu interval[p50=%uus p99=%uus max=%uus]\n",
+      (unsigned long long)r.reports, (unsigned long long)r.invalid, (unsigned long long)r.lost,
+      r.interval.percentile(50), r.interval.percentile(99), r.interval.max());
+  }
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "RCBrain.hpp"
+#include "RCChannelMap.hpp"
+#include "RCTransmitter.hpp"
+#include "rc-protocol.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// one gamepad input as SDL delivered it, what the recorder writes and the replay feeds back
+struct [[gnu::packed]] RCInputEvent {
+  uint64_t timestamp_ns; // SDL_Event timestamp
+  uint16_t type; // rc::GamepadEvent::SDL_EVENT_GAMEPAD_*
+  uint8_t index; // axis or button
+  int16_t value; // axis value, 0 for buttons
+};
+
+// gamepad input that reaches the bridge, live SDL events and replays both go through here so they send the same GamepadEvents
+class RCInput {
+private:
+  RCBrain& _brain;
+  RCTransmitter& _transmitter;
+  RCChannelMap& _map;
+
+  // raw input since the last evaluate()
+  std::array<int16_t, rc::SDL_GAMEPAD_AXIS_COUNT> _axes = {};
+  uint32_t _held = 0;
+  uint32_t _pressed = 0;
+  std::array<uint16_t, rc::CRSF_CHANNEL_COUNT> _channels = {};
+
+public:
+  RCInput(RCBrain& brain, RCTransmitter& transmitter, RCChannelMap& map) : _brain{brain}, _transmitter{transmitter}, _map{map} {
+    // centered sticks and released buttons until the first input arrives
+    evaluate();
+  }
+
+  void apply(const RCInputEvent& input, std::chrono::steady_clock::time_point sampled_at) {
+    switch (input.type) {
+    case rc::GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION:
+      if (input.index < _axes.size()) {
+        _axes[input.index] = input.value;
+      }
+      _transmitter.setAxis(input.index, unshapedAxis(input.value), sampled_at);
+      break;
+
+    case rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_DOWN: {
+      rc::GamepadEvent gamepad_event;
+      gamepad_event.type = rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_DOWN;
+      gamepad_event.button_down.button = input.index;
+      _brain.write(gamepad_event);
+      _transmitter.setButton(input.index, true);
+      if (input.index < 32) {
+        _held |= 1u << input.index;
+        _pressed |= 1u << input.index;
+      }
+    } break;
+
+    case rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_UP: {
+      _transmitter.setButton(input.index, false);
+      if (input.index < 32) {
+        _held &= ~(1u << input.index);
+      }
+      rc::GamepadEvent gamepad_event;
+      gamepad_event.type = rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_UP;
+      gamepad_event.button_up.button = input.index;
+      _brain.write(gamepad_event);
+    } break;
+    }
+  }
+
+  // runs the channel map over the input applied so far and publishes it to the transmitter as one snapshot,
+  // called once per input tick after the events of the tick were applied
+  void evaluate() {
+    _map.evaluate(_axes, _held, _pressed, _channels);
+    _pressed = 0;
+    _transmitter.setChannels(_channels, _map.mask());
+    _transmitter.publish();
+  }
+};
+
+// recordings are a small header followed by packed RCInputEvents in the order they were applied
+struct [[gnu::packed]] RCInputRecordingHeader {
+  static constexpr uint32_t MAGIC = 0x4E495352; // "RSIN"
+  static constexpr uint16_t VERSION = 1;
+
+  uint32_t magic = MAGIC;
+  uint16_t version = VERSION;
+  uint16_t event_size = sizeof(RCInputEvent);
+};
+
+// appends every applied input to a file, buffered by stdio so recording costs a memcpy per event
+class RCInputRecorder {
+private:
+  FILE* _file = nullptr;
+  uint64_t _events = 0;
+
+public:
+  ~RCInputRecorder() {
+    close();
+  }
+
+  bool open(std::string_view path) {
+    close();
+    _file = fopen(std::string{path}.c_str(), "wb");
+    if (!_file) {
+      return false;
+    }
+    RCInputRecordingHeader header;
+    fwrite(&header, sizeof(header), 1, _file);
+    return true;
+  }
+
+  inline void record(const RCInputEvent& input) {
+    if (_file) {
+      fwrite(&input, sizeof(input), 1, _file);
+      _events++;
+    }
+  }
+
+  void close() {
+    if (_file) {
+      fclose(_file);
+      _file = nullptr;
+      printf("input recording: %llu events\n", (unsigned long long)_events);
+    }
+  }
+};
+
+// a recording loaded into memory, played back against a clock that starts at the first event
+class RCInputReplay {
+private:
+  std::vector<RCInputEvent> _events;
+  size_t _next = 0;
+
+public:
+  bool load(std::string_view path) {
+    auto file = fopen(std::string{path}.c_str(), "rb");
+    if (!file) {
+      return false;
+    }
+
+    RCInputRecordingHeader header;
+    auto ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == RCInputRecordingHeader::MAGIC &&
+              header.version == RCInputRecordingHeader::VERSION && header.event_size == sizeof(RCInputEvent);
+    _events.clear();
+    for (RCInputEvent input; ok && fread(&input, sizeof(input), 1, file) == 1;) {
+      _events.push_back(input);
+    }
+    fclose(file);
+    _next = 0;
+    return ok;
+  }
+
+  inline std::span<const RCInputEvent> events() const {
+    return _events;
+  }
+
+  inline bool done() const {
+    return _next == _events.size();
+  }
+
+  // time from the first to the last event
+  std::chrono::nanoseconds length() const {
+    return _events.empty() ? std::chrono::nanoseconds{0} : std::chrono::nanoseconds{_events.back().timestamp_ns - _events.front().timestamp_ns};
+  }
+
+  // calls apply(input, offset) for every event due at elapsed time since the start of the replay
+  template <typename F>
+  void playUntil(std::chrono::nanoseconds elapsed, F&& apply) {
+    for (; _next < _events.size(); _next++) {
+      auto offset = std::chrono::nanoseconds{_events[_next].timestamp_ns - _events.front().timestamp_ns};
+      if (offset > elapsed) {
+        break;
+      }
+      apply(_events[_next], offset);
+    }
+  }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "crsf-structs.hpp"
+#include "rc-protocol.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// raw axes only, shaped channels have their own deadzone per axis
+constexpr auto SDL_GAMEPAD_DEADZONE = 8192;
+
+// what bridges without PAD_EVENT_CRSF_CHANNELS get, they map the raw axes to channels themselves
+constexpr int16_t unshapedAxis(int16_t value) {
+  if (value > -SDL_GAMEPAD_DEADZONE && value < SDL_GAMEPAD_DEADZONE) {
+    return 0;
+  }
+  return value > 0 ? value - SDL_GAMEPAD_DEADZONE : value + SDL_GAMEPAD_DEADZONE;
+}
+
+// how one stick or trigger turns into a crsf channel value
+struct RCAxisShape {
+  static constexpr uint8_t NO_CHANNEL = 0xFF;
+
+  uint8_t channel = NO_CHANNEL; // crsf channel, 0 is aileron
+  int16_t center = 0; // raw value the stick rests at
+  uint16_t deadzone = 8192; // raw units around the center, the travel beyond it is rescaled to the full range
+  float expo = 0; // 0 linear .. 1 cubic
+  float rate = 1; // scales the deflection, clipped at the channel limits
+  bool invert = false;
+  // only deflection above the center counts, it spans CHANNEL_VALUE_MIN..CHANNEL_VALUE_MAX on its own (throttle)
+  bool unipolar = false;
+
+  // the channel value of a raw SDL axis value, what the lookup table is compiled from
+  constexpr uint16_t evaluate(int16_t raw) const {
+    int32_t offset = raw - center;
+    int32_t distance = offset < 0 ? -offset : offset;
+    float span = offset < 0 ? center - INT16_MIN : INT16_MAX - center;
+    float dead = deadzone < span ? deadzone : span - 1;
+
+    float x = distance <= dead ? 0 : (distance - dead) / (span - dead);
+    x = offset < 0 ? -x : x;
+    x = invert ? -x : x;
+    x = x * (1 - expo) + x * x * x * expo;
+    x = x * rate;
+    x = x > 1 ? 1 : x < -1 ? -1 : x;
+    if (unipolar) {
+      x = (x > 0 ? x : 0) * 2 - 1;
+    }
+
+    if (x >= 0) {
+      return crsf::CHANNEL_VALUE_MID + (uint16_t)(x * (crsf::CHANNEL_VALUE_MAX - crsf::CHANNEL_VALUE_MID) + 0.5f);
+    }
+    return crsf::CHANNEL_VALUE_MID - (uint16_t)(-x * (crsf::CHANNEL_VALUE_MID - crsf::CHANNEL_VALUE_MIN) + 0.5f);
+  }
+};
+
+// mode 2 on the sticks, the same channels the bridge maps raw axes to
+constexpr std::array<RCAxisShape, rc::SDL_GAMEPAD_AXIS_COUNT> DEFAULT_AXIS_SHAPES = {{
+  {.channel = 0}, // left x, aileron
+  {.channel = 2, .invert = true, .unipolar = true}, // left y, throttle
+  {.channel = 3}, // right x, rudder
+  {.channel = 1, .invert = true}, // right y, elevator
+  {}, // left trigger
+  {}, // right trigger
+}};
+
+static_assert(DEFAULT_AXIS_SHAPES[0].evaluate(INT16_MIN) == crsf::CHANNEL_VALUE_MIN);
+static_assert(DEFAULT_AXIS_SHAPES[0].evaluate(0) == crsf::CHANNEL_VALUE_MID);
+static_assert(DEFAULT_AXIS_SHAPES[0].evaluate(INT16_MAX) == crsf::CHANNEL_VALUE_MAX);
+static_assert(DEFAULT_AXIS_SHAPES[1].evaluate(INT16_MIN) == crsf::CHANNEL_VALUE_MAX);
+static_assert(DEFAULT_AXIS_SHAPES[1].evaluate(0) == crsf::CHANNEL_VALUE_MIN);
+
+// every axis shape compiled into a table with an entry per raw value, so shaping a sample is a single lookup
+class RCInputShaping {
+private:
+  std::array<RCAxisShape, rc::SDL_GAMEPAD_AXIS_COUNT> _shapes = DEFAULT_AXIS_SHAPES;
+  // indexed by raw value - INT16_MIN, empty for axes without a channel
+  std::array<std::vector<uint16_t>, rc::SDL_GAMEPAD_AXIS_COUNT> _tables;
+  uint16_t _mask = 0;
+
+  static bool parseField(RCAxisShape& shape, std::string_view field, std::string_view value) {
+    auto parse = [&](auto& out) {
+      return std::from_chars(value.data(), value.data() + value.size(), out).ec == std::errc{};
+    };
+
+    int number = 0;
+    if (field == "channel") {
+      // 1..16 as radios count them, 0 leaves the axis unmapped
+      if (!parse(number) || number < 0 || number > rc::CRSF_CHANNEL_COUNT) {
+        return false;
+      }
+      shape.channel = number ? number - 1 : RCAxisShape::NO_CHANNEL;
+    } else if (field == "center") {
+      return parse(shape.center);
+    } else if (field == "deadzone") {
+      return parse(shape.deadzone);
+    } else if (field == "expo" || field == "rate") {
+      float factor = 0;
+      if (!parse(factor) || factor < 0 || (field == "expo" && factor > 1)) {
+        return false;
+      }
+      (field == "expo" ? shape.expo : shape.rate) = factor;
+    } else if (field == "invert" || field == "unipolar") {
+      if (!parse(number)) {
+        return false;
+      }
+      (field == "invert" ? shape.invert : shape.unipolar) = number;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+public:
+  static constexpr std::string_view AXIS_NAMES[rc::SDL_GAMEPAD_AXIS_COUNT] = {
+    "leftx", "lefty", "rightx", "righty", "left_trigger", "right_trigger",
+  };
+
+  RCInputShaping() {
+    compile();
+  }
+
+  // back to DEFAULT_AXIS_SHAPES, takes effect with the next compile()
+  void reset() {
+    _shapes = DEFAULT_AXIS_SHAPES;
+  }
+
+  // one axis.field=value setting, e.g. lefty.expo=0.3. false if it is not a valid axis setting
+  bool configure(std::string_view name, std::string_view field, std::string_view value) {
+    auto axis = std::find(std::begin(AXIS_NAMES), std::end(AXIS_NAMES), name) - std::begin(AXIS_NAMES);
+    return axis < rc::SDL_GAMEPAD_AXIS_COUNT && parseField(_shapes[axis], field, value);
+  }
+
+  // builds the lookup tables, when the shapes change and never on the input path
+  void compile() {
+    _mask = 0;
+    for (size_t axis = 0; axis < _shapes.size(); axis++) {
+      auto& shape = _shapes[axis];
+      auto& table = _tables[axis];
+      if (shape.channel >= rc::CRSF_CHANNEL_COUNT) {
+        table.clear();
+        continue;
+      }
+      table.resize(UINT16_MAX + 1);
+      for (int32_t raw = INT16_MIN; raw <= INT16_MAX; raw++) {
+        table[raw - INT16_MIN] = shape.evaluate(raw);
+      }
+      _mask |= 1u << shape.channel;
+    }
+  }
+
+  inline const RCAxisShape& shape(uint8_t axis) const {
+    return _shapes[axis];
+  }
+
+  // the crsf channel an axis drives, NO_CHANNEL if none
+  inline uint8_t channel(uint8_t axis) const {
+    return axis < _shapes.size() ? _shapes[axis].channel : RCAxisShape::NO_CHANNEL;
+  }
+
+  // bit n = some axis drives crsf channel n
+  inline uint16_t mask() const {
+    return _mask;
+  }
+
+  // the compiled table of an axis with a channel, indexed by raw value - INT16_MIN
+  inline const uint16_t* table(uint8_t axis) const {
+    return _tables[axis].data();
+  }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+
+// last known parameter values of each crsf module, so the menu has them before the module answered a single read.
+// one file per module identity, a reflashed module gets a new firmware_id and with it a fresh cache.
+// lives in the user's cache directory because the executable's directory may be a read only AppImage mount.
+class RCParameterCache {
+public:
+  struct Module {
+    uint32_t serial_number;
+    uint32_t hardware_id;
+    uint32_t firmware_id;
+    uint8_t parameter_version;
+    std::string name;
+  };
+
+private:
+  Module _module;
+  std::filesystem::path _path;
+  std::map<uint8_t, uint8_t> _values;
+  bool _dirty = false;
+
+  static std::filesystem::path directory() {
+    if (auto cache_home = std::getenv("XDG_CACHE_HOME"); cache_home && *cache_home) {
+      return std::filesystem::path{cache_home} / "steamdeck-rc";
+    }
+    if (auto home = std::getenv("HOME"); home && *home) {
+      return std::filesystem::path{home} / ".cache" / "steamdeck-rc";
+    }
+    return {};
+  }
+
+public:
+  inline bool loaded() const {
+    return !_path.empty();
+  }
+
+  // switches to the cache of the given module, returns the number of values it had.
+  // what changed in the previous one is saved first
+  size_t load(const Module& module) {
+    unload();
+
+    auto dir = directory();
+    if (dir.empty()) {
+      return 0;
+    }
+
+    _path = dir / std::format("elrs-{:08x}-{:08x}-{:08x}-{}.cfg", module.serial_number, module.hardware_id, module.firmware_id, module.parameter_version);
+    _module = module;
+
+    std::ifstream cfg_stream{_path};
+    std::string line;
+    while (std::getline(cfg_stream, line)) {
+      if (line.starts_with('#')) {
+        continue;
+      }
+      auto separator = line.find('=');
+      if (separator == std::string::npos) {
+        continue;
+      }
+
+      unsigned parameter = 0, value = 0;
+      auto key = std::string_view{line}.substr(0, separator);
+      auto text = std::string_view{line}.substr(separator + 1);
+      if (std::from_chars(key.data(), key.data() + key.size(), parameter).ec == std::errc{} &&
+          std::from_chars(text.data(), text.data() + text.size(), value).ec == std::errc{} && parameter <= UINT8_MAX && value <= UINT8_MAX) {
+        _values[parameter] = value;
+      }
+    }
+    return _values.size();
+  }
+
+  // saves what changed and forgets the module, nothing is stored until the next load()
+  void unload() {
+    saveIfDirty();
+    _path.clear();
+    _values.clear();
+    _module = {};
+  }
+
+  inline const Module& module() const {
+    return _module;
+  }
+
+  inline const std::map<uint8_t, uint8_t>& values() const {
+    return _values;
+  }
+
+  void store(uint8_t parameter, uint8_t value) {
+    if (!loaded()) {
+      return;
+    }
+    auto [it, inserted] = _values.try_emplace(parameter, value);
+    if (inserted || it->second != value) {
+      it->second = value;
+      _dirty = true;
+    }
+  }
+
+  // writes the file if anything changed, through a temporary file so a crash never leaves half of it
+  void saveIfDirty() {
+    if (!_dirty) {
+      return;
+    }
+    _dirty = false;
+
+    std::error_code error;
+    std::filesystem::create_directories(_path.parent_path(), error);
+
+    auto temporary = _path;
+    temporary += ".tmp";
+    {
+      std::ofstream cfg_stream{temporary, std::ios::trunc};
+      cfg_stream << "# " << _module.name << "\n";
+      for (auto [parameter, value] : _values) {
+        cfg_stream << (unsigned)parameter << "=" << (unsigned)value << "\n";
+      }
+      if (!cfg_stream) {
+        printf("parameter cache: failed to write %s\n", temporary.c_str());
+        return;
+      }
+    }
+    std::filesystem::rename(temporary, _path, error);
+    if (error) {
+      printf("parameter cache: failed to write %s: %s\n", _path.c_str(), error.message().c_str());
+    }
+  }
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include "RCBrain.hpp"
+#include "rc-messages.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// one crsf parameter as the module describes it
+struct RCParameterEntry {
+  enum Type : uint8_t {
+    UINT8 = 0x00,
+    INT8 = 0x01,
+    UINT16 = 0x02,
+    INT16 = 0x03,
+    FLOAT = 0x08,
+    TEXT_SELECTION = 0x09,
+    STRING = 0x0A,
+    FOLDER = 0x0B,
+    INFO = 0x0C,
+    COMMAND = 0x0D,
+  };
+
+  uint8_t id;
+  uint8_t parent;
+  uint8_t type;
+  bool hidden;
+  std::string name;
+
+  // numbers and text selections, floats scaled by 10^decimals
+  int32_t value = 0;
+  int32_t min_value = 0;
+  int32_t max_value = 0;
+  uint8_t decimals = 0;
+  std::string unit;
+  // text selections, unavailable options are empty
+  std::vector<std::string> options;
+  // strings, info and command status text
+  std::string text;
+  // folders, if the module lists them
+  std::vector<uint8_t> children;
+
+  // parses an entry from the folder byte on, as the bridge forwards it
+  static std::optional<RCParameterEntry> parse(uint8_t id, std::span<const uint8_t> data) {
+    if (data.size() < 3) {
+      return std::nullopt;
+    }
+
+    RCParameterEntry entry;
+    entry.id = id;
+    entry.parent = data[0];
+    entry.type = data[1] & 0x7F;
+    entry.hidden = data[1] & 0x80;
+
+    size_t offset = 2;
+    auto string = [&]() {
+      // cut off before the string started
+      if (offset >= data.size()) {
+        return std::string{};
+      }
+      auto len = strnlen((const char*)&data[offset], data.size() - offset);
+      std::string str{(const char*)&data[offset], len};
+      offset = std::min(offset + len + 1, data.size());
+      return str;
+    };
+    // big endian, zero past the end so a truncated entry still parses
+    auto number = [&](size_t size, bool is_signed) {
+      uint32_t value = 0;
+      for (size_t i = 0; i < size; i++) {
+        value = (value << 8) | (offset < data.size() ? data[offset++] : 0);
+      }
+      if (is_signed && size < 4 && (value & (1u << (size * 8 - 1)))) {
+        value |= UINT32_MAX << (size * 8);
+      }
+      return (int32_t)value;
+    };
+
+    entry.name = string();
+
+    switch (entry.type) {
+    case UINT8:
+    case INT8:
+    case UINT16:
+    case INT16: {
+      auto size = entry.type < UINT16 ? 1 : 2;
+      auto is_signed = entry.type & 1;
+      entry.value = number(size, is_signed);
+      entry.min_value = number(size, is_signed);
+      entry.max_value = number(size, is_signed);
+      entry.unit = string();
+    } break;
+    case FLOAT:
+      entry.value = number(4, true);
+      entry.min_value = number(4, true);
+      entry.max_value = number(4, true);
+      number(4, true); // default
+      entry.decimals = number(1, false);
+      number(4, true); // step
+      entry.unit = string();
+      break;
+    case TEXT_SELECTION: {
+      auto options = string();
+      for (size_t begin = 0;;) {
+        auto end = options.find(';', begin);
+        entry.options.emplace_back(options.substr(begin, end - begin));
+        if (end == std::string::npos) {
+          break;
+        }
+        begin = end + 1;
+      }
+      entry.value = number(1, false);
+      entry.min_value = number(1, false);
+      entry.max_value = number(1, false);
+      number(1, false); // default
+      entry.unit = string();
+    } break;
+    case STRING:
+    case INFO:
+      entry.text = string();
+      break;
+    case FOLDER:
+      while (offset < data.size() && data[offset] != 0xFF) {
+        entry.children.push_back(data[offset++]);
+      }
+      break;
+    case COMMAND:
+      entry.value = number(1, false); // status
+      number(1, false); // timeout
+      entry.text = string();
+      break;
+    }
+    return entry;
+  }
+};
+
+// the module's parameter tree, discovered through whole entry reads instead of a hardcoded list.
+// folders load lazily, the bridge reads the entries of a request back to back so a full load costs
+// one host round trip per PARAMETER_ENTRIES_PER_READ entries instead of one per entry.
+class RCParameterTree {
+public:
+  static constexpr uint8_t ROOT = 0;
+  static constexpr auto TIMEOUT = std::chrono::seconds{1};
+  static constexpr uint8_t MAX_ATTEMPTS = 3;
+  // a full load slower than this is reported
+  static constexpr auto LOAD_BUDGET = std::chrono::seconds{3};
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Pending {
+    clock::time_point requested_at;
+    clock::time_point sent_at;
+    uint8_t attempts;
+  };
+
+  RCBrain& _brain;
+  std::map<uint8_t, RCParameterEntry> _entries;
+  std::map<uint8_t, Pending> _pending;
+  // slices of entries still arriving
+  std::map<uint8_t, std::vector<uint8_t>> _partial;
+  // folders opened before their own entry was there
+  std::set<uint8_t> _opening;
+  uint8_t _total = 0;
+
+  std::optional<clock::time_point> _load_started;
+  clock::duration _last_load{};
+  LatencyHistogram _latency;
+  uint64_t _retries = 0;
+  uint64_t _failures = 0;
+
+  void request(std::span<const uint8_t> parameters) {
+    auto now = clock::now();
+    std::vector<uint8_t> ids;
+    for (auto parameter : parameters) {
+      if (_entries.contains(parameter) || _pending.contains(parameter)) {
+        continue;
+      }
+      _pending[parameter] = {now, now, 1};
+      ids.push_back(parameter);
+    }
+    _brain.readParameterEntries(ids);
+  }
+
+  // every parameter the module has, for modules whose folders do not list their children
+  void requestAll() {
+    std::vector<uint8_t> ids;
+    for (unsigned parameter = 1; parameter <= _total; parameter++) {
+      ids.push_back(parameter);
+    }
+    request(ids);
+  }
+
+  void onEntry(RCParameterEntry&& entry) {
+    auto id = entry.id;
+    if (auto it = _pending.find(id); it != _pending.end()) {
+      _latency.record(clock::now() - it->second.requested_at);
+      _pending.erase(it);
+    }
+    auto& stored = _entries[id] = std::move(entry);
+    if (on_entry) {
+      on_entry(stored);
+    }
+
+    if (_opening.erase(id)) {
+      openFolder(id);
+    }
+
+    finishLoad();
+  }
+
+  void finishLoad() {
+    if (!_load_started || !complete()) {
+      return;
+    }
+    _last_load = clock::now() - *_load_started;
+    _load_started.reset();
+    auto ms = (long long)std::chrono::duration_cast<std::chrono::milliseconds>(_last_load).count();
+    printf("parameter tree: %u entries loaded in %lldms%s\n", _total, ms, _last_load > LOAD_BUDGET ? " (over budget)" : "");
+    if (on_loaded) {
+      on_loaded();
+    }
+  }
+
+public:
+  std::function<void(const RCParameterEntry&)> on_entry;
+  // a loadAll() finished
+  std::function<void()> on_loaded;
+
+  explicit RCParameterTree(RCBrain& brain) : _brain{brain} {
+    // nothing
+  }
+
+  // feed the parameter count of every RC_EVENT_REPORT_DEVICE_INFO through here
+  inline void onDeviceInfo(uint8_t parameters_total) {
+    _total = parameters_total;
+  }
+
+  const RCParameterEntry* find(uint8_t parameter) const {
+    auto it = _entries.find(parameter);
+    return it != _entries.end() ? &it->second : nullptr;
+  }
+
+  inline const std::map<uint8_t, RCParameterEntry>& entries() const {
+    return _entries;
+  }
+
+  // all parameters of the module are loaded
+  bool complete() const {
+    for (unsigned parameter = 1; parameter <= _total; parameter++) {
+      if (!_entries.contains(parameter)) {
+        return false;
+      }
+    }
+    return _total > 0;
+  }
+
+  // these entries, whatever folder they are in
+  void load(std::span<const uint8_t> parameters) {
+    request(parameters);
+  }
+
+  // the entries of a folder, after the folder's own entry if it is not there yet
+  void openFolder(uint8_t folder = ROOT) {
+    auto entry = find(folder);
+    if (!entry) {
+      _opening.insert(folder);
+      request({&folder, 1});
+      return;
+    }
+    if (entry->type != RCParameterEntry::FOLDER) {
+      return;
+    }
+    if (entry->children.empty()) {
+      requestAll();
+      return;
+    }
+    request(entry->children);
+  }
+
+  // every entry, timed against LOAD_BUDGET
+  void loadAll() {
+    if (!_total) {
+      return;
+    }
+    _load_started = clock::now();
+    requestAll();
+    finishLoad();
+  }
+
+  // feed every RC_EVENT_REPORT_PARAMETER_ENTRY through here
+  void onEntrySlice(const rc::msg::ReportParameterEntry::payload_type& slice) {
+    auto& data = _partial[slice.parameter];
+    // slices arrive in order, a gap means one got lost and the entry starts over on the retry
+    if (slice.offset != data.size() || slice.len > sizeof(slice.data)) {
+      _partial.erase(slice.parameter);
+      return;
+    }
+    data.insert(data.end(), slice.data, slice.data + slice.len);
+    if (data.size() < slice.total) {
+      return;
+    }
+
+    auto entry = RCParameterEntry::parse(slice.parameter, data);
+    _partial.erase(slice.parameter);
+    if (entry) {
+      onEntry(std::move(*entry));
+    }
+  }
+
+  // resends timed out reads, called from a housekeeping timer
+  void tick() {
+    auto now = clock::now();
+    std::vector<uint8_t> retry;
+    for (auto it = _pending.begin(); it != _pending.end();) {
+      auto parameter = it->first;
+      auto& pending = it->second;
+      it++;
+
+      if (now - pending.sent_at < TIMEOUT) {
+        continue;
+      }
+      if (pending.attempts >= MAX_ATTEMPTS) {
+        _failures++;
+        _pending.erase(parameter);
+        _partial.erase(parameter);
+        // a module that does not answer for its root folder gets scanned instead
+        if (_opening.erase(parameter) && parameter == ROOT) {
+          requestAll();
+        }
+        continue;
+      }
+      _retries++;
+      pending.sent_at = now;
+      pending.attempts++;
+      retry.push_back(parameter);
+    }
+    _brain.readParameterEntries(retry);
+  }
+
+  // the bridge came back, reads in flight are lost and the module may have been swapped
+  void reset() {
+    _entries.clear();
+    _pending.clear();
+    _partial.clear();
+    _opening.clear();
+    _load_started.reset();
+  }
+
+  void print() const {
+    std::function<void(uint8_t, int)> printFolder = [&](uint8_t folder, int depth) {
+      for (auto& [id, entry] : _entries) {
+        if (entry.parent != folder || id == folder) {
+          continue;
+        }
+        printf("%*s0x%02X %s", depth * 2, "", id, entry.name.c_str());
+        if (entry.type == RCParameterEntry::TEXT_SELECTION && entry.value < (int32_t)entry.options.size()) {
+          printf(" = %s", entry.options[entry.value].c_str());
+        } else if (entry.type <= RCParameterEntry::FLOAT) {
+          printf(" = %d%s", entry.value, entry.unit.c_str());
+        } else if (!entry.text.empty()) {
+          printf(" = %s", entry.text.c_str());
+        }
+        printf("%s\n", entry.hidden ? " (hidden)" : "");
+        if (entry.type == RCParameterEntry::FOLDER) {
+          printFolder(id, depth + 1);
+        }
+      }
+    };
+    printFolder(ROOT, 0);
+  }
+
+  void printReport() {
+    printf("parameter tree: loaded=%zu/%u pending=%zu retries=%llu failures=%llu last_load=%lldms latency[p50=%uus p99=%uus]\n",
+      _entries.size(), _total, _pending.size(), (unsigned long long)_retries, (unsigned long long)_failures,
+      (long long)std::chrono::duration_cast<std::chrono::milliseconds>(_last_load).count(), _latency.percentile(50), _latency.percentile(99));
+    _latency.reset();
+    _retries = 0;
+    _failures = 0;
+  }
+};
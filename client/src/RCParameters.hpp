@@ -0,0 +1,352 @@
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include "RCBrain.hpp"
+#include "RCParameterCache.hpp"
+#include "rc-protocol.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+struct RCParametersStats {
+  // request to verified value
+  LatencyHistogram latency;
+
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  // reads answered by a request already in flight or a recent report, nothing sent
+  uint64_t deduplicated = 0;
+  // writes that replaced the value of a write still in flight
+  uint64_t coalesced = 0;
+  uint64_t retries = 0;
+  uint64_t failures = 0;
+  // cached values read again in the background
+  uint64_t revalidations = 0;
+};
+
+// parameter reads and writes as requests that complete when the bridge reports the value.
+// identical reads share one request, writes are verified by reading the value back and retried until it sticks.
+// values are cached per module, the menu shows the cached ones right away and they are read again one by one while disarmed.
+// everything runs on the thread that reads the bridge, nothing here ever blocks.
+class RCParameters {
+public:
+  // called once when a request ends, with the value the module holds: the one read, the target of a write that
+  // was verified, or for a write that did not stick within MAX_ATTEMPTS the value reported last. nullopt if the
+  // bridge never reported the parameter
+  using Completion = std::function<void(std::optional<uint8_t>)>;
+
+  static constexpr auto TIMEOUT = std::chrono::milliseconds{500};
+  static constexpr uint8_t MAX_ATTEMPTS = 4;
+  // a report this recent answers a read without asking the bridge again
+  static constexpr auto MAX_AGE = std::chrono::seconds{2};
+  // one cached value is read again per interval, so revalidating never crowds the link
+  static constexpr auto REVALIDATE_INTERVAL = std::chrono::milliseconds{250};
+  // without device info by then, the module is read without a cache
+  static constexpr auto DEVICE_INFO_TIMEOUT = std::chrono::seconds{2};
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Request {
+    bool write;
+    // target of a write
+    uint8_t value;
+    // the target changed after the last send
+    bool changed;
+    // value reported before the write started, what the module holds if the write never gets an answer
+    std::optional<uint8_t> previous;
+    std::vector<Completion> completions;
+    clock::time_point started_at;
+    clock::time_point sent_at;
+    uint8_t attempts;
+  };
+
+  struct Report {
+    uint8_t value;
+    clock::time_point received_at;
+  };
+
+  RCBrain& _brain;
+  std::unordered_map<uint8_t, Request> _requests;
+  std::unordered_map<uint8_t, Report> _reports;
+  RCParametersStats _stats;
+
+  RCParameterCache _cache;
+  // cached values waiting to be read again
+  std::vector<uint8_t> _stale;
+  clock::time_point _revalidated_at;
+  clock::time_point _waiting_since = clock::now();
+  bool _module_known = false;
+  bool _armed = false;
+
+  void revalidate(uint8_t parameter) {
+    if (std::find(_stale.begin(), _stale.end(), parameter) == _stale.end()) {
+      _stale.push_back(parameter);
+    }
+  }
+
+  void send(uint8_t parameter, Request& request) {
+    if (request.write) {
+      _brain.setParameter(parameter, request.value);
+    }
+    // a write is read back, the bridge only reports what the module actually took
+    _brain.getParameter(parameter);
+    request.sent_at = clock::now();
+    request.attempts++;
+    request.changed = false;
+  }
+
+  Request& start(uint8_t parameter, bool write, uint8_t value) {
+    auto& request = _requests[parameter];
+    request.write = write;
+    request.value = value;
+    request.previous = std::nullopt;
+    request.completions.clear();
+    request.started_at = clock::now();
+    request.attempts = 0;
+    send(parameter, request);
+    return request;
+  }
+
+  inline std::optional<uint8_t> reported(uint8_t parameter) const {
+    if (auto it = _reports.find(parameter); it != _reports.end()) {
+      return it->second.value;
+    }
+    return std::nullopt;
+  }
+
+  void complete(uint8_t parameter, Request& request, std::optional<uint8_t> value) {
+    auto now = clock::now();
+    if (value) {
+      _stats.latency.record(now - request.started_at);
+      if (request.write) {
+        printf("parameter 0x%02X = %u (verified in %lldus)\n",
+          parameter, *value, (long long)std::chrono::duration_cast<std::chrono::microseconds>(now - request.started_at).count());
+      }
+    } else {
+      _stats.failures++;
+      printf("parameter 0x%02X: %s failed after %u attempts\n", parameter, request.write ? "write" : "read", request.attempts);
+      // a report that arrived during the write is newer than the one from before it.
+      // on_value gets it again so nothing keeps showing the value the module did not take
+      if (request.write) {
+        value = reported(parameter);
+        if (!value) {
+          value = request.previous;
+        }
+        if (value && on_value) {
+          on_value(parameter, *value);
+        }
+      }
+    }
+
+    // erased first, a completion may start the next request for the same parameter
+    auto completions = std::move(request.completions);
+    _requests.erase(parameter);
+    for (auto& completion : completions) {
+      completion(value);
+    }
+  }
+
+public:
+  // called with every known value of a parameter: cached, reported, or the last known one after a write that failed
+  std::function<void(uint8_t, uint8_t)> on_value;
+
+  // parameters shown in the config menu
+  static constexpr uint8_t CONFIG_PARAMETERS[] = {rc::PARAM_PACKET_RATE, rc::PARAM_TLM_RATIO, rc::PARAM_MAX_POWER, rc::PARAM_LINK_MODE};
+
+  explicit RCParameters(RCBrain& brain) : _brain{brain} {
+    // nothing
+  }
+
+  // nothing is sent if a request is in flight or a recent report is known, on_complete is called right away then
+  void read(uint8_t parameter, Completion on_complete = {}) {
+    _stats.reads++;
+
+    if (auto it = _requests.find(parameter); it != _requests.end()) {
+      _stats.deduplicated++;
+      if (on_complete) {
+        it->second.completions.push_back(std::move(on_complete));
+      }
+      return;
+    }
+
+    if (auto it = _reports.find(parameter); it != _reports.end() && clock::now() - it->second.received_at < MAX_AGE) {
+      _stats.deduplicated++;
+      if (on_complete) {
+        on_complete(it->second.value);
+      }
+      return;
+    }
+
+    auto& request = start(parameter, false, 0);
+    if (on_complete) {
+      request.completions.push_back(std::move(on_complete));
+    }
+  }
+
+  void write(uint8_t parameter, uint8_t value, Completion on_complete = {}) {
+    _stats.writes++;
+    auto previous = reported(parameter);
+    _reports.erase(parameter);
+
+    auto it = _requests.find(parameter);
+    if (it == _requests.end()) {
+      auto& request = start(parameter, true, value);
+      request.previous = previous;
+      if (on_complete) {
+        request.completions.push_back(std::move(on_complete));
+      }
+      return;
+    }
+
+    // the request in flight completes with the newest value, it is sent once the bridge answered the previous one
+    auto& request = it->second;
+    if (on_complete) {
+      request.completions.push_back(std::move(on_complete));
+    }
+    if (request.write) {
+      _stats.coalesced++;
+      request.value = value;
+      request.changed = true;
+      return;
+    }
+
+    request.write = true;
+    request.value = value;
+    request.previous = previous;
+    request.attempts = 0;
+    send(parameter, request);
+  }
+
+  // reads what is unknown right away, cached values are only revalidated in the background.
+  // waits for the device info first, until then it is not known which cache applies
+  void readAll() {
+    if (!_module_known) {
+      return;
+    }
+    for (auto parameter : CONFIG_PARAMETERS) {
+      if (!_reports.contains(parameter) && _cache.values().contains(parameter)) {
+        revalidate(parameter);
+      } else {
+        read(parameter);
+      }
+    }
+  }
+
+  // feed every RC_EVENT_REPORT_DEVICE_INFO through here
+  void onDeviceInfo(const RCParameterCache::Module& module) {
+    _module_known = true;
+    auto count = _cache.load(module);
+    printf("parameter cache: %s (serial 0x%08X firmware 0x%08X), %zu cached values\n", module.name.c_str(), module.serial_number, module.firmware_id, count);
+
+    for (auto [parameter, value] : _cache.values()) {
+      if (on_value && !_reports.contains(parameter)) {
+        on_value(parameter, value);
+      }
+    }
+    readAll();
+  }
+
+  // feed every RC_EVENT_REPORT_PARAMETER through here
+  void onReport(uint8_t parameter, uint8_t value) {
+    _reports[parameter] = {value, clock::now()};
+    _cache.store(parameter, value);
+    std::erase(_stale, parameter);
+    if (on_value) {
+      on_value(parameter, value);
+    }
+
+    auto it = _requests.find(parameter);
+    if (it == _requests.end()) {
+      return;
+    }
+
+    auto& request = it->second;
+    if (!request.write || request.value == value) {
+      complete(parameter, request, value);
+      return;
+    }
+
+    // a write coalesced while the previous one was in flight goes out now, a stale report is waited out
+    if (request.changed) {
+      request.attempts = 0;
+      send(parameter, request);
+    }
+  }
+
+  // parameter traffic is kept off the link while armed, apart from what the user asks for
+  inline void setArmed(bool armed) {
+    _armed = armed;
+  }
+
+  // retries timed out requests, revalidates the cache and saves it, called from a housekeeping timer
+  void tick() {
+    auto now = clock::now();
+    _cache.saveIfDirty();
+
+    if (!_module_known && now - _waiting_since > DEVICE_INFO_TIMEOUT) {
+      printf("parameter cache: no device info from the module, reading without a cache\n");
+      _module_known = true;
+      readAll();
+    }
+
+    if (!_armed && _requests.empty() && !_stale.empty() && now - _revalidated_at > REVALIDATE_INTERVAL) {
+      auto parameter = _stale.front();
+      _stale.erase(_stale.begin());
+      _stats.revalidations++;
+      _revalidated_at = now;
+      read(parameter);
+    }
+
+    for (auto it = _requests.begin(); it != _requests.end();) {
+      auto parameter = it->first;
+      auto& request = it->second;
+      it++;
+
+      if (now - request.sent_at < TIMEOUT) {
+        continue;
+      }
+      if (request.attempts >= MAX_ATTEMPTS) {
+        complete(parameter, request, std::nullopt);
+        continue;
+      }
+      _stats.retries++;
+      send(parameter, request);
+    }
+  }
+
+  // the bridge came back, forget what it reported and ask again for everything in flight.
+  // the module may have been swapped, its device info decides which cache applies
+  void reset() {
+    _cache.unload();
+    _reports.clear();
+    _stale.clear();
+    _module_known = false;
+    _waiting_since = clock::now();
+    for (auto& [parameter, request] : _requests) {
+      send(parameter, request);
+    }
+  }
+
+  inline size_t inFlight() const {
+    return _requests.size();
+  }
+
+  RCParametersStats takeStats() {
+    auto stats = _stats;
+    _stats = {};
+    return stats;
+  }
+
+  void printReport() {
+    auto s = takeStats();
+    printf("parameters: reads=%llu writes=%llu deduplicated=%llu coalesced=%llu retries=%llu failures=%llu revalidations=%llu in_flight=%zu latency[p50=%uus p99=%uus max=%uus]\n",
+      (unsigned long long)s.reads, (unsigned long long)s.writes, (unsigned long long)s.deduplicated, (unsigned long long)s.coalesced,
+      (unsigned long long)s.retries, (unsigned long long)s.failures, (unsigned long long)s.revalidations, inFlight(), s.latency.percentile(50), s.latency.percentile(99), s.latency.max());
+  }
+};
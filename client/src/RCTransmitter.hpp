@@ -0,0 +1,397 @@
+#pragma once
+
+#include "EventLoop.hpp"
+#include "LatencyHistogram.hpp"
+#include "LatestValue.hpp"
+#include "RCBrain.hpp"
+#include "RCChannelMap.hpp"
+#include "rc-protocol.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+struct RCTransmitterOptions {
+  std::chrono::nanoseconds period = std::chrono::milliseconds{4};
+  // SCHED_FIFO priority of the transmit thread, 0 keeps SCHED_OTHER
+  int fifo_priority = 0;
+  // cpu the transmit thread is pinned to, -1 lets the scheduler decide
+  int cpu = -1;
+  // a PAD_EVENT_PING rides along with the channels of every tick this far apart, 0 disables it
+  std::chrono::nanoseconds ping_interval = std::chrono::milliseconds{100};
+};
+
+struct RCTransmitterStats {
+  // wakeup time minus the absolute deadline of the tick
+  LatencyHistogram lateness;
+  // deviation of the time between two wakeups from the period
+  LatencyHistogram interval_error;
+  // age of the oldest axis sample included in a tick
+  LatencyHistogram input_latency;
+  // from the newest stick sample in a tick to its write to the bridge returning
+  LatencyHistogram sample_age;
+
+  uint64_t ticks = 0;
+  uint64_t missed_ticks = 0;
+
+  RCBrainStats brain;
+
+  // adds the counts of another window, for totals over several reports
+  void merge(const RCTransmitterStats& other) {
+    lateness.merge(other.lateness);
+    interval_error.merge(other.interval_error);
+    input_latency.merge(other.input_latency);
+    sample_age.merge(other.sample_age);
+    ticks += other.ticks;
+    missed_ticks += other.missed_ticks;
+    brain.merge(other.brain);
+  }
+};
+
+// the raw sticks, buttons and shaped channels of one input tick, handed to the transmit thread as a whole
+// by RCTransmitter::publish() so a channels update never mixes two ticks
+struct RCTransmitterInput {
+  std::array<int16_t, rc::SDL_GAMEPAD_AXIS_COUNT> axes = {};
+  uint32_t buttons = 0; // bit n = SDL_GamepadButton n is pressed
+  // shaped channel values in crsf units, mask bit n = channel n is driven by the host
+  std::array<uint16_t, rc::CRSF_CHANNEL_COUNT> crsf_channels = {};
+  uint16_t crsf_mask = 0;
+  // steady_clock ns of the newest axis sample in axes, 0 before the first one
+  int64_t sampled_at_ns = 0;
+};
+
+// the sticks as they are right now, read by the transmit thread at every deadline
+struct RCAxisSample {
+  std::array<int16_t, rc::SDL_GAMEPAD_AXIS_COUNT> axes = {};
+  int64_t sampled_at_ns = 0; // steady_clock
+};
+
+class RCAxisSampler {
+public:
+  virtual ~RCAxisSampler() = default;
+
+  // false if nothing was sampled since the last call, only ever called from the transmit thread
+  virtual bool sample(RCAxisSample& sample) = 0;
+};
+
+// sends the current axis state to the RCBrain on absolute deadlines from a dedicated thread,
+// so slow overlay updates or mpv events on the main thread can not delay the channel cadence.
+// this thread is the only serial writer, it also wakes up for urgent events queued with RCBrain::write().
+class RCTransmitter {
+private:
+  using clock = std::chrono::steady_clock;
+
+  RCBrain& _brain;
+
+  std::thread _thread;
+  std::atomic<bool> _running = false;
+
+  // input thread side, changed by setAxis()/setButton()/setChannels() until publish()
+  RCTransmitterInput _staged;
+  LatestValue<RCTransmitterInput> _published;
+  // transmit thread side, the newest input taken
+  RCTransmitterInput _input;
+  // sample time (clock ns) of the oldest axis value not yet sent, 0 if none
+  std::atomic<int64_t> _pending_input = 0;
+
+  // with a sampler the sticks are read right before each write instead of taken from the last input tick.
+  // the main thread sets and clears it while the transmit thread runs, when hidraw comes and goes
+  std::atomic<RCAxisSampler*> _sampler = nullptr;
+  const RCChannelMap* _map = nullptr;
+  RCAxisSample _sample;
+
+  RCTransmitterStats _stats;
+
+  // published roughly once per second, try_lock'ed so the transmit thread never blocks on it
+  std::mutex _report_mutex;
+  RCTransmitterStats _report;
+
+  static void configureThread(const RCTransmitterOptions& options) {
+    if (options.cpu >= 0) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(options.cpu, &cpuset);
+      if (auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) {
+        printf("transmitter: failed to pin to cpu %d: %s\n", options.cpu, strerror(error));
+      }
+    }
+
+    if (options.fifo_priority > 0) {
+      sched_param param{};
+      param.sched_priority = options.fifo_priority;
+      if (auto error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+        printf("transmitter: failed to set SCHED_FIFO %d: %s\n", options.fifo_priority, strerror(error));
+      }
+    }
+  }
+
+  uint32_t _ping_sequence = 0;
+
+  // replaces the raw axes and the axis channels of the tick with the newest sample, which is never older than what
+  // the input tick evaluated. returns true if the sticks moved since the last tick
+  bool sampleAxes(RCAxisSampler& sampler, rc::GamepadEvent* crsf_channels, rc::GamepadEvent& channels) {
+    auto before = _sample.axes;
+    if (!sampler.sample(_sample) && !_sample.sampled_at_ns) {
+      return false;
+    }
+    if (crsf_channels) {
+      auto& packed = crsf_channels->crsf_channels;
+      std::array<uint16_t, rc::CRSF_CHANNEL_COUNT> values;
+      for (size_t i = 0; i < values.size(); i++) {
+        values[i] = packed.values[i];
+      }
+      _map->evaluateAxes(_sample.axes, values);
+      for (size_t i = 0; i < values.size(); i++) {
+        packed.values[i] = values[i];
+      }
+    }
+    for (size_t i = 0; i < _sample.axes.size(); i++) {
+      channels.channels.axes[i] = unshapedAxis(_sample.axes[i]);
+    }
+    return _sample.axes != before;
+  }
+
+  // returns the sample time (clock ns) of the newest stick sample in the tick, 0 before the first one
+  int64_t writeChannels(bool ping) {
+    rc::GamepadEvent gamepad_events[3];
+    uint8_t count = 0;
+
+    _published.take(_input);
+
+    // RCBrain::send() picks the shaped channels or the raw axes, whichever the bridge accepts
+    if (_input.crsf_mask) {
+      auto& crsf_channels = gamepad_events[count++];
+      crsf_channels.type = rc::GamepadEvent::PAD_EVENT_CRSF_CHANNELS;
+      for (size_t i = 0; i < _input.crsf_channels.size(); i++) {
+        crsf_channels.crsf_channels.values[i] = _input.crsf_channels[i];
+      }
+      crsf_channels.crsf_channels.mask = _input.crsf_mask;
+    }
+
+    auto& channels = gamepad_events[count++];
+    channels.type = rc::GamepadEvent::PAD_EVENT_CHANNELS;
+    for (size_t i = 0; i < _input.axes.size(); i++) {
+      channels.channels.axes[i] = _input.axes[i];
+    }
+    channels.channels.buttons = _input.buttons;
+
+    // the sticks stay as old as their last sample until they move, every tick reports that age.
+    // with a sampler they are sampled as late as possible, the input tick only supplies the buttons then
+    auto newest = _input.sampled_at_ns;
+    if (auto sampler = _sampler.load(std::memory_order_acquire)) {
+      if (sampleAxes(*sampler, count > 1 ? &gamepad_events[0] : nullptr, channels)) {
+        _pending_input.store(_sample.sampled_at_ns, std::memory_order_relaxed);
+      }
+      newest = _sample.sampled_at_ns;
+    } else if (_sample.sampled_at_ns) {
+      // cleared, a sampler set again later starts without the old sticks
+      _sample = {};
+    }
+
+    // stamped right before the write it goes out with, so the rtt does not include the wait for the tick
+    if (ping) {
+      auto& ping_event = gamepad_events[count++];
+      ping_event.type = rc::GamepadEvent::PAD_EVENT_PING;
+      ping_event.ping.sequence = _ping_sequence++;
+      ping_event.ping.sent_at_ns = clock::now().time_since_epoch().count();
+
+      // how old the newest stick sample is when it leaves, the input stage of the per-stage breakdown
+      ping_event.ping.sample_age_us = newest ? (uint32_t)std::min<int64_t>((ping_event.ping.sent_at_ns - newest) / 1000, UINT32_MAX - 1) : UINT32_MAX;
+    }
+
+    _brain.send({gamepad_events, count});
+    return newest;
+  }
+
+  void run(RCTransmitterOptions options) {
+    configureThread(options);
+
+    TimerFD timer;
+    timer.start(options.period);
+
+    pollfd pfds[] = {
+      {timer.fd(), POLLIN, 0},
+      {_brain.urgentFD(), POLLIN, 0},
+    };
+
+    auto last_wakeup = clock::now();
+    auto ticks_per_report = std::chrono::seconds{1} / options.period;
+    auto ticks_per_ping = options.ping_interval.count() ? std::max<int64_t>(options.ping_interval / options.period, 1) : 0;
+
+    while (_running.load(std::memory_order_relaxed)) {
+      if (poll(pfds, std::size(pfds), -1) <= 0) {
+        continue;
+      }
+
+      if (pfds[1].revents & POLLIN) {
+        _brain.sendUrgent();
+      }
+
+      if (!(pfds[0].revents & POLLIN)) {
+        continue;
+      }
+
+      auto expirations = timer.consume();
+      if (!expirations) {
+        continue;
+      }
+
+      auto now = clock::now();
+      _stats.lateness.record(now - timer.lastExpiry());
+      _stats.interval_error.record(std::chrono::abs(now - last_wakeup - options.period));
+      _stats.missed_ticks += expirations - 1;
+      _stats.ticks++;
+      last_wakeup = now;
+
+      auto newest = writeChannels(ticks_per_ping && _stats.ticks % ticks_per_ping == 0);
+
+      auto written = clock::now().time_since_epoch();
+      if (newest) {
+        _stats.sample_age.record(written - std::chrono::nanoseconds{newest});
+      }
+      if (auto pending = _pending_input.exchange(0, std::memory_order_relaxed)) {
+        _stats.input_latency.record(written - std::chrono::nanoseconds{pending});
+      }
+
+      if (_stats.ticks % ticks_per_report == 0) {
+        std::unique_lock lock{_report_mutex, std::try_to_lock};
+        if (lock) {
+          _report = _stats;
+          _report.brain = _brain.takeStats();
+          _stats = {};
+        }
+      }
+    }
+
+    // the window since the last report, so a report taken after stop() counts every tick
+    std::lock_guard lock{_report_mutex};
+    _stats.brain = _brain.takeStats();
+    _report.merge(_stats);
+    _stats = {};
+  }
+
+public:
+  explicit RCTransmitter(RCBrain& brain) : _brain{brain} {
+    // nothing
+  }
+
+  ~RCTransmitter() {
+    stop();
+  }
+
+  // staged until publish(), like setButton()
+  inline void setAxis(uint8_t axis, int16_t value, clock::time_point sampled_at = clock::now()) {
+    if (axis >= _staged.axes.size()) {
+      return;
+    }
+
+    _staged.axes[axis] = value;
+
+    // the sampler times the sticks itself
+    if (_sampler.load(std::memory_order_relaxed)) {
+      return;
+    }
+    int64_t none = 0;
+    _pending_input.compare_exchange_strong(none, sampled_at.time_since_epoch().count(), std::memory_order_relaxed);
+    _staged.sampled_at_ns = std::max(_staged.sampled_at_ns, (int64_t)sampled_at.time_since_epoch().count());
+  }
+
+  // reads the sticks from sampler at every deadline and evaluates the axis channels of map with them there,
+  // instead of sending what the last input tick stored. both must outlive stop(), map is the same on every call
+  inline void setSampler(RCAxisSampler& sampler, const RCChannelMap& map) {
+    _map = &map;
+    _sampler.store(&sampler, std::memory_order_release);
+  }
+
+  // back to the axes of the input tick, once the sampler has nothing to deliver anymore
+  inline void clearSampler() {
+    _sampler.store(nullptr, std::memory_order_release);
+  }
+
+  // the mapped crsf channels of one input tick, staged until publish() like the axes
+  inline void setChannels(const std::array<uint16_t, rc::CRSF_CHANNEL_COUNT>& values, uint16_t mask) {
+    _staged.crsf_channels = values;
+    _staged.crsf_mask = mask;
+  }
+
+  inline void setButton(uint8_t button, bool down) {
+    if (button >= 32) {
+      return;
+    }
+
+    if (down) {
+      _staged.buttons |= 1u << button;
+    } else {
+      _staged.buttons &= ~(1u << button);
+    }
+  }
+
+  // hands everything staged to the transmit thread at once, called once per input tick
+  inline void publish() {
+    _published.publish(_staged);
+  }
+
+  // one channels update from the calling thread, for replays that run the cadence on their own clock.
+  // never while the thread runs, it is the only writer then
+  inline void transmitNow() {
+    writeChannels(false);
+    _pending_input.store(0, std::memory_order_relaxed);
+  }
+
+  void start(const RCTransmitterOptions& options = {}) {
+    if (_running.exchange(true)) {
+      return;
+    }
+
+    _thread = std::thread{&RCTransmitter::run, this, options};
+  }
+
+  void stop() {
+    _running = false;
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+  }
+
+  RCTransmitterStats takeReport() {
+    std::lock_guard lock{_report_mutex};
+    auto report = _report;
+    _report = {};
+    return report;
+  }
+
+  void printReport() {
+    auto r = takeReport();
+    printf("transmitter: ticks=%llu missed=%llu lateness[p50=%uus p99=%uus max=%uus] interval_error[p50=%uus p99=%uus max=%uus] input_latency[p50=%uus p99=%uus max=%uus] sample_age[p50=%uus p99=%uus max=%uus]\n",
+      (unsigned long long)r.ticks, (unsigned long long)r.missed_ticks,
+      r.lateness.percentile(50), r.lateness.percentile(99), r.lateness.max(),
+      r.interval_error.percentile(50), r.interval_error.percentile(99), r.interval_error.max(),
+      r.input_latency.percentile(50), r.input_latency.percentile(99), r.input_latency.max(),
+      r.sample_age.percentile(50), r.sample_age.percentile(99), r.sample_age.max());
+    printf("brain: events=%llu writes=%llu write_errors=%llu unsupported=%llu dropped=%llu\n",
+      (unsigned long long)r.brain.events, (unsigned long long)r.brain.writes, (unsigned long long)r.brain.write_errors,
+      (unsigned long long)r.brain.unsupported, (unsigned long long)_brain.dropped());
+
+    if (r.brain.reconnects) {
+      printf("brain: reconnects=%llu reconnect[p50=%uus max=%uus]%s\n",
+        (unsigned long long)r.brain.reconnects, r.brain.reconnect.percentile(50), r.brain.reconnect.max(),
+        std::chrono::microseconds{r.brain.reconnect.max()} > RCBrain::RECONNECT_BUDGET ? " over budget" : "");
+    }
+
+    static const char* class_names[LATENCY_CLASS_COUNT] = {"urgent", "coalesced", "bulk"};
+    for (int i = 0; i < LATENCY_CLASS_COUNT; i++) {
+      auto& c = r.brain.classes[i];
+      printf("brain[%s]: events=%llu flushes=%llu coalesced=%llu wait[p50=%uus p99=%uus max=%uus]\n",
+        class_names[i], (unsigned long long)c.events, (unsigned long long)c.flushes, (unsigned long long)c.coalesced,
+        c.wait.percentile(50), c.wait.percentile(99), c.wait.max());
+    }
+  }
+};
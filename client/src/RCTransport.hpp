@@ -0,0 +1,444 @@
+#pragma once
+
+#include "EventLoop.hpp"
+#include "SerialDevices.hpp"
+#include "rc-protocol.hpp"
+#include "rc-udp-link.hpp"
+#include "serialib.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <netdb.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// byte pipe between RCBrain and the bridge, RCBrain does the batching and framing on top of it.
+// write() is only called from the transmit thread, everything else from the main thread.
+// fd() stays the same number for the lifetime of the transport, even across disconnect()/reconnect(),
+// so the transmit thread never writes to a closed or reused descriptor.
+class RCTransport {
+protected:
+  std::atomic<bool> _connected = false;
+
+  // puts /dev/null behind fd, see serialib::detachDevice()
+  static void detach(int fd) {
+    auto null = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null >= 0) {
+      dup2(null, fd);
+      ::close(null);
+    }
+  }
+
+public:
+  virtual ~RCTransport() = default;
+
+  // opens the transport, the descriptor is valid afterwards even if the bridge is not reachable yet
+  virtual bool open() = 0;
+
+  // reopens the bridge in place of the current descriptor
+  virtual bool reconnect() = 0;
+
+  // drops the bridge, writes keep succeeding into the void until reconnect()
+  virtual void disconnect() = 0;
+
+  virtual int fd() const = 0;
+
+  virtual bool write(const uint8_t* data, size_t len) = 0;
+
+  // moves whatever is pending into the ring without blocking, head and tail run freely and wrap on ring_size
+  virtual int readAvailable(uint8_t* ring, unsigned int ring_size, unsigned int* head, unsigned int tail) = 0;
+
+  inline bool connected() const {
+    return _connected.load(std::memory_order_relaxed);
+  }
+
+  // "udp://host:port", "unix:/path" or a serial device path, empty finds the serial device by usb identity.
+  // nullptr if the uri is malformed
+  static std::unique_ptr<RCTransport> create(std::string_view uri, uint32_t baud = 115200, const SerialDeviceMatch& match = {});
+};
+
+// the esp32 over usb cdc (or any tty)
+class RCSerialTransport : public RCTransport {
+private:
+  serialib _serial;
+  std::string _path;
+  uint32_t _baud;
+  SerialDeviceMatch _match;
+
+  // the configured path, or the first device matching the usb identity
+  std::optional<std::string> devicePath() const {
+    if (!_path.empty()) {
+      return _path;
+    }
+    return findSerialDevice(_match);
+  }
+
+  // configured vs effective rate and what the driver does to latency, printed once per open
+  void printOpenReport(std::string_view path) {
+    auto effective = _serial.effectiveBauds();
+    // time on the wire for a full CDC packet, irrelevant for native USB CDC but not for a USB-UART bridge
+    auto packet_us = effective ? rc::CDC_PACKET_SIZE * 10 * 1'000'000ull / effective : 0;
+
+    // usb-serial bridges (ftdi, cp210x...) batch received bytes for latency_timer ms
+    std::string latency_timer = "n/a";
+    std::error_code error;
+    auto device = std::filesystem::canonical(path, error).filename();
+    std::ifstream latency_timer_stream{std::filesystem::path{"/sys/class/tty"} / device / "device/latency_timer"};
+    if (latency_timer_stream >> latency_timer) {
+      latency_timer += "ms";
+    }
+
+    printf("serial: %.*s baud[configured=%u effective=%u] packet=%lluus low_latency=%s latency_timer=%s\n",
+      (int)path.size(), path.data(), _baud, effective, packet_us, _serial.isLowLatency() ? "yes" : "no", latency_timer.c_str());
+  }
+
+public:
+  RCSerialTransport(std::string_view path, uint32_t baud, const SerialDeviceMatch& match) : _path{path}, _baud{baud}, _match{match} {
+    // nothing
+  }
+
+  bool open() override {
+    auto device_path = devicePath();
+    if (!device_path || _serial.openDevice(device_path->data(), _baud) != 1) {
+      _serial.detachDevice();
+      return false;
+    }
+
+    printOpenReport(*device_path);
+    _connected = true;
+    return true;
+  }
+
+  bool reconnect() override {
+    auto device_path = devicePath();
+    if (!device_path || _serial.reopenDevice(device_path->data(), _baud) != 1) {
+      return false;
+    }
+
+    printOpenReport(*device_path);
+    _connected = true;
+    return true;
+  }
+
+  void disconnect() override {
+    _serial.detachDevice();
+    _connected = false;
+  }
+
+  int fd() const override {
+    return _serial.fileDescriptor();
+  }
+
+  bool write(const uint8_t* data, size_t len) override {
+    return _serial.writeBytes(data, len) == 1;
+  }
+
+  int readAvailable(uint8_t* ring, unsigned int ring_size, unsigned int* head, unsigned int tail) override {
+    return _serial.readAvailable(ring, ring_size, head, tail);
+  }
+};
+
+// a network attached bridge, every flush is one datagram of the rc udp link (see rc-udp-link.hpp).
+// received payloads go through the link's jitter buffer, fd() is an epoll set of the socket and the
+// playout timer so the event loop also wakes up when a buffered payload becomes due.
+class RCUDPTransport : public RCTransport {
+private:
+  using clock = std::chrono::steady_clock;
+
+  int _fd = -1;
+  int _poll_fd = -1;
+  TimerFD _playout_timer;
+
+  std::string _host;
+  std::string _port;
+
+  // transmit thread only
+  rc::UDPLinkSender _sender;
+  std::array<uint8_t, rc::UDP_LINK_MAX_DATAGRAM_SIZE> _datagram;
+
+  // main thread only
+  rc::UDPLinkReceiver _receiver;
+
+  static inline uint32_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(clock::now().time_since_epoch()).count();
+  }
+
+  int connectSocket() {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* result = nullptr;
+    if (getaddrinfo(_host.data(), _port.data(), &hints, &result) != 0) {
+      return -1;
+    }
+
+    auto fd = -1;
+    for (auto ai = result; ai && fd < 0; ai = ai->ai_next) {
+      fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+      if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(result);
+    return fd;
+  }
+
+  // the socket is registered by file description, it has to be added again once dup2() replaced it
+  void watchSocket() {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = _fd;
+    epoll_ctl(_poll_fd, EPOLL_CTL_ADD, _fd, &event);
+  }
+
+public:
+  RCUDPTransport(std::string_view host, std::string_view port, uint8_t redundancy = 2, const rc::UDPLinkReceiverOptions& options = {})
+    : _host{host}, _port{port}, _sender{redundancy}, _receiver{options} {
+    _poll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = _playout_timer.fd();
+    epoll_ctl(_poll_fd, EPOLL_CTL_ADD, _playout_timer.fd(), &event);
+  }
+
+  ~RCUDPTransport() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+    if (_poll_fd >= 0) {
+      ::close(_poll_fd);
+    }
+  }
+
+  bool open() override {
+    _fd = connectSocket();
+    if (_fd < 0) {
+      _fd = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+      return false;
+    }
+
+    watchSocket();
+    printf("udp: %s:%s\n", _host.data(), _port.data());
+    _connected = true;
+    return true;
+  }
+
+  bool reconnect() override {
+    auto fd = connectSocket();
+    if (fd < 0) {
+      return false;
+    }
+    dup2(fd, _fd);
+    ::close(fd);
+    watchSocket();
+    _connected = true;
+    return true;
+  }
+
+  void disconnect() override {
+    detach(_fd);
+    _connected = false;
+  }
+
+  int fd() const override {
+    return _poll_fd;
+  }
+
+  bool write(const uint8_t* data, size_t len) override {
+    auto size = _sender.encode(data, len, nowUs(), _datagram.data());
+    return size && ::send(_fd, _datagram.data(), size, MSG_NOSIGNAL) == (ssize_t)size;
+  }
+
+  int readAvailable(uint8_t* ring, unsigned int ring_size, unsigned int* head, unsigned int tail) override {
+    uint8_t datagram[1500];
+    ssize_t len;
+    while ((len = ::recv(_fd, datagram, sizeof(datagram), MSG_DONTWAIT)) >= 0) {
+      _receiver.push(datagram, len, nowUs());
+    }
+    _playout_timer.consume();
+
+    int total = 0;
+    auto now_us = nowUs();
+    _receiver.pop(now_us, [&](const uint8_t* payload, uint8_t payload_len) {
+      if (ring_size - (*head - tail) < payload_len) {
+        return false;
+      }
+      for (uint8_t i = 0; i < payload_len; i++) {
+        ring[(*head)++ % ring_size] = payload[i];
+      }
+      total += payload_len;
+      return true;
+    });
+
+    uint32_t playout_us = 0;
+    if (_receiver.nextPlayout(playout_us)) {
+      // wraps like the link's timestamps
+      _playout_timer.startAt(clock::now() + std::chrono::microseconds{std::max<int32_t>((int32_t)(playout_us - now_us), 0)});
+    }
+    return total;
+  }
+
+  inline const rc::UDPLinkReceiver& receiver() const {
+    return _receiver;
+  }
+};
+
+// a bridge process on the same machine, e.g. one that forwards to a remote esp32
+class RCUnixTransport : public RCTransport {
+private:
+  int _fd = -1;
+  std::string _path;
+
+  int connectSocket() {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (_path.size() >= sizeof(addr.sun_path)) {
+      return -1;
+    }
+    memcpy(addr.sun_path, _path.data(), _path.size());
+
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      return -1;
+    }
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+  }
+
+public:
+  explicit RCUnixTransport(std::string_view path) : _path{path} {
+    // nothing
+  }
+
+  ~RCUnixTransport() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+  }
+
+  bool open() override {
+    _fd = connectSocket();
+    if (_fd < 0) {
+      _fd = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+      return false;
+    }
+
+    printf("unix: %s\n", _path.data());
+    _connected = true;
+    return true;
+  }
+
+  bool reconnect() override {
+    auto fd = connectSocket();
+    if (fd < 0) {
+      return false;
+    }
+    dup2(fd, _fd);
+    ::close(fd);
+    _connected = true;
+    return true;
+  }
+
+  void disconnect() override {
+    detach(_fd);
+    _connected = false;
+  }
+
+  int fd() const override {
+    return _fd;
+  }
+
+  bool write(const uint8_t* data, size_t len) override {
+    return ::send(_fd, data, len, MSG_NOSIGNAL) == (ssize_t)len;
+  }
+
+  int readAvailable(uint8_t* ring, unsigned int ring_size, unsigned int* head, unsigned int tail) override {
+    return serialib::readAvailable(_fd, ring, ring_size, head, tail);
+  }
+};
+
+// both ends in the same process, peerFD() is the bridge side.
+// lets the full batching and framing path run without any hardware.
+class RCLoopbackTransport : public RCTransport {
+private:
+  int _fds[2] = {-1, -1};
+
+public:
+  ~RCLoopbackTransport() {
+    for (auto fd : _fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  bool open() override {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, _fds) != 0) {
+      return false;
+    }
+    _connected = true;
+    return true;
+  }
+
+  // the pair can not come back once it is gone
+  bool reconnect() override {
+    return false;
+  }
+
+  void disconnect() override {
+    detach(_fds[0]);
+    _connected = false;
+  }
+
+  int fd() const override {
+    return _fds[0];
+  }
+
+  inline int peerFD() const {
+    return _fds[1];
+  }
+
+  bool write(const uint8_t* data, size_t len) override {
+    return ::send(_fds[0], data, len, MSG_NOSIGNAL) == (ssize_t)len;
+  }
+
+  int readAvailable(uint8_t* ring, unsigned int ring_size, unsigned int* head, unsigned int tail) override {
+    return serialib::readAvailable(_fds[0], ring, ring_size, head, tail);
+  }
+};
+
+inline std::unique_ptr<RCTransport> RCTransport::create(std::string_view uri, uint32_t baud, const SerialDeviceMatch& match) {
+  if (uri.starts_with("udp://")) {
+    auto address = uri.substr(6);
+    auto port = address.rfind(':');
+    if (port == std::string_view::npos) {
+      return nullptr;
+    }
+    return std::make_unique<RCUDPTransport>(address.substr(0, port), address.substr(port + 1));
+  }
+  if (uri.starts_with("unix:")) {
+    return std::make_unique<RCUnixTransport>(uri.substr(5));
+  }
+  return std::make_unique<RCSerialTransport>(uri, baud, match);
+}
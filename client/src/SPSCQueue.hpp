@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+// wait-free bounded single-producer/single-consumer ring.
+// push() may only be called from one thread and pop()/drain() from one other thread.
+// producer and consumer state live on separate cache lines so the two sides never false-share.
+template <typename T, size_t Capacity>
+class SPSCQueue {
+private:
+  static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+  static constexpr size_t MASK = Capacity - 1;
+
+  // producer side
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail = 0;
+  size_t _cached_head = 0;
+
+  // consumer side
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head = 0;
+  size_t _cached_tail = 0;
+
+  alignas(CACHE_LINE_SIZE) std::array<T, Capacity> _slots;
+
+public:
+  // returns false if the queue is full
+  inline bool push(const T& value) {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _cached_head == Capacity) {
+      _cached_head = _head.load(std::memory_order_acquire);
+      if (tail - _cached_head == Capacity) {
+        return false;
+      }
+    }
+
+    _slots[tail & MASK] = value;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // returns false if the queue is empty
+  inline bool pop(T& value) {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (head == _cached_tail) {
+      _cached_tail = _tail.load(std::memory_order_acquire);
+      if (head == _cached_tail) {
+        return false;
+      }
+    }
+
+    value = _slots[head & MASK];
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // calls fn for every element available right now, releases the slots in one store
+  template <typename F>
+  size_t drain(F&& fn, size_t max = Capacity) {
+    auto head = _head.load(std::memory_order_relaxed);
+    _cached_tail = _tail.load(std::memory_order_acquire);
+
+    size_t count = 0;
+    while (head != _cached_tail && count < max) {
+      fn(_slots[head & MASK]);
+      head++;
+      count++;
+    }
+
+    if (count) {
+      _head.store(head, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // only exact when called while the other side is idle
+  inline size_t sizeApprox() const {
+    return _tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_relaxed);
+  }
+
+  static constexpr size_t capacity() {
+    return Capacity;
+  }
+};
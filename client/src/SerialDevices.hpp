@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// usb identity of the serial bridge, 0 and empty match anything
+struct SerialDeviceMatch {
+  // espressif
+  uint16_t vid = 0x303A;
+  uint16_t pid = 0;
+  std::string serial;
+
+  // "vid:pid[:serial]" in hex, as printed by lsusb
+  static SerialDeviceMatch parse(std::string_view value) {
+    SerialDeviceMatch match;
+    auto vid_end = value.find(':');
+    std::from_chars(value.data(), value.data() + std::min(vid_end, value.size()), match.vid, 16);
+    if (vid_end == std::string_view::npos) {
+      return match;
+    }
+
+    auto pid = value.substr(vid_end + 1);
+    auto pid_end = pid.find(':');
+    std::from_chars(pid.data(), pid.data() + std::min(pid_end, pid.size()), match.pid, 16);
+    if (pid_end != std::string_view::npos) {
+      match.serial = pid.substr(pid_end + 1);
+    }
+    return match;
+  }
+};
+
+// finds the tty of a usb serial device through sysfs instead of opening every /dev/ttyACM* in turn
+inline std::optional<std::string> findSerialDevice(const SerialDeviceMatch& match) {
+  namespace fs = std::filesystem;
+
+  auto readAttribute = [](const fs::path& dir, const char* name) {
+    std::string value;
+    std::ifstream{dir / name} >> value;
+    return value;
+  };
+
+  auto readHex = [&](const fs::path& dir, const char* name) {
+    auto value = readAttribute(dir, name);
+    uint16_t number = 0;
+    std::from_chars(value.data(), value.data() + value.size(), number, 16);
+    return number;
+  };
+
+  std::error_code error;
+  for (auto& entry : fs::directory_iterator{"/sys/class/tty", error}) {
+    auto name = entry.path().filename().string();
+    if (!name.starts_with("ttyACM") && !name.starts_with("ttyUSB")) {
+      continue;
+    }
+
+    // the usb device directory holding idVendor is a parent of the tty's interface (ACM) or port (USB)
+    auto dir = fs::canonical(entry.path() / "device", error);
+    while (!error && dir.has_relative_path() && !fs::exists(dir / "idVendor")) {
+      dir = dir.parent_path();
+    }
+    if (error || !dir.has_relative_path()) {
+      continue;
+    }
+
+    if (match.vid && readHex(dir, "idVendor") != match.vid) {
+      continue;
+    }
+    if (match.pid && readHex(dir, "idProduct") != match.pid) {
+      continue;
+    }
+    if (!match.serial.empty() && readAttribute(dir, "serial") != match.serial) {
+      continue;
+    }
+
+    return "/dev/" + name;
+  }
+
+  return std::nullopt;
+}
+
+// wakes up when udev creates a tty node or finishes setting its permissions.
+// watches /dev with inotify, which needs no netlink socket or libudev.
+class SerialHotplug {
+private:
+  int _fd = -1;
+
+public:
+  SerialHotplug() {
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    inotify_add_watch(_fd, "/dev", IN_CREATE | IN_ATTRIB);
+  }
+
+  ~SerialHotplug() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+  }
+
+  SerialHotplug(const SerialHotplug&) = delete;
+  SerialHotplug& operator=(const SerialHotplug&) = delete;
+
+  inline int fd() const {
+    return _fd;
+  }
+
+  // drains pending notifications, returns true if any of them was about a tty
+  bool consume() {
+    alignas(inotify_event) char buffer[4096];
+    auto found = false;
+
+    ssize_t len;
+    while ((len = ::read(_fd, buffer, sizeof(buffer))) > 0) {
+      for (char* ptr = buffer; ptr < buffer + len;) {
+        auto event = (inotify_event*)ptr;
+        if (event->len && std::string_view{event->name}.starts_with("tty")) {
+          found = true;
+        }
+        ptr += sizeof(inotify_event) + event->len;
+      }
+    }
+    return found;
+  }
+};
@@ -0,0 +1,727 @@
+#include "bench.hpp"
+#include "LatencyHistogram.hpp"
+#include "RCBrain.hpp"
+#include "RCTransport.hpp"
+#include "SPSCQueue.hpp"
+#include "rc-framing.hpp"
+#include "rc-messages.hpp"
+#include "rc-protocol.hpp"
+#include "serialib.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <format>
+#include <functional>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <queue>
+#include <random>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static void pinToCPU(int cpu) {
+  if (cpu >= (int)std::thread::hardware_concurrency()) {
+    return;
+  }
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+}
+
+// producer and consumer hammer the ring from two cores.
+// events/sec is measured flat out, latency with the producer paced to the 250Hz x 5 events control load
+// and flat out, since that is where the consumer falls behind.
+static int benchSPSC() {
+  struct QueuedEvent {
+    rc::GamepadEvent gamepad_event;
+    bench_clock::rep enqueued_at;
+  };
+
+  auto run = [](const char* name, std::chrono::nanoseconds pace, std::chrono::seconds duration) {
+    static SPSCQueue<QueuedEvent, 256> queue;
+
+    std::atomic<bool> running = true;
+    uint64_t produced = 0;
+    uint64_t full = 0;
+
+    std::thread producer{[&]() {
+      pinToCPU(1);
+
+      QueuedEvent queued{};
+      queued.gamepad_event.type = rc::GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION;
+
+      auto next = bench_clock::now();
+      while (running.load(std::memory_order_relaxed)) {
+        if (pace.count()) {
+          next += pace;
+          while (bench_clock::now() < next) {
+          }
+        }
+
+        queued.gamepad_event.axis_motion.value = (int16_t)produced;
+        queued.enqueued_at = bench_clock::now().time_since_epoch().count();
+        if (queue.push(queued)) {
+          produced++;
+        } else {
+          full++;
+        }
+      }
+    }};
+
+    pinToCPU(2);
+
+    LatencyHistogram latency;
+    uint64_t consumed = 0;
+
+    auto begin = bench_clock::now();
+    auto end = begin + duration;
+    while (bench_clock::now() < end) {
+      consumed += queue.drain([&](const QueuedEvent& queued) {
+        latency.record(bench_clock::now() - bench_clock::time_point{bench_clock::duration{queued.enqueued_at}});
+      });
+    }
+
+    running = false;
+    producer.join();
+    consumed += queue.drain([](const QueuedEvent&) {});
+
+    auto seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+    printf("spsc[%s]: events=%.0f/s full=%llu latency[p50=%uus p99=%uus max=%uus]\n",
+      name, consumed / seconds, (unsigned long long)full, latency.percentile(50), latency.percentile(99), latency.max());
+
+    return produced == consumed;
+  };
+
+  auto ok = true;
+  ok &= run("flat-out", std::chrono::nanoseconds{0}, std::chrono::seconds{2});
+  ok &= run("paced-1250hz", std::chrono::microseconds{800}, std::chrono::seconds{2});
+  return ok ? 0 : 1;
+}
+
+// decode throughput of a clean RemoteEvent stream, then the cost of a corrupted byte:
+// how many frames and bytes are lost before the decoder is locked on again.
+static int benchFraming() {
+  constexpr auto FRAME_COUNT = 200'000;
+
+  std::mt19937 rng{1616};
+
+  std::vector<uint8_t> stream;
+  stream.reserve(FRAME_COUNT * rc::FRAME_MAX_SIZE);
+  std::vector<size_t> frame_offsets;
+  frame_offsets.reserve(FRAME_COUNT);
+
+  rc::RemoteEvent remote_event{};
+  uint8_t frame[rc::FRAME_MAX_SIZE];
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    remote_event.type = i % 6;
+    auto bytes = (uint8_t*)&remote_event.report_telemetry;
+    for (size_t j = 0; j < sizeof(remote_event.report_telemetry); j++) {
+      bytes[j] = rng();
+    }
+    frame_offsets.push_back(stream.size());
+    auto len = rc::RemoteMessages::encode(remote_event, frame);
+    stream.insert(stream.end(), frame, frame + len);
+  }
+
+  {
+    rc::FrameDecoder decoder;
+    auto begin = bench_clock::now();
+    for (auto byte : stream) {
+      if (decoder.push(byte)) {
+        rc::RemoteMessages::decode(decoder.payload(), decoder.payloadSize(), remote_event);
+      }
+    }
+    auto seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+    printf("framing[clean]: %.1fMB/s frames=%.0f/s decoded=%u/%d\n",
+      stream.size() / seconds / 1e6, decoder.stats().frames / seconds, decoder.stats().frames, FRAME_COUNT);
+    if (decoder.stats().frames != FRAME_COUNT) {
+      return 1;
+    }
+  }
+
+  // corrupt one byte (flip or drop) every 1000 frames
+  constexpr auto CORRUPTION_INTERVAL = 1000;
+
+  auto corrupted = stream;
+  std::vector<size_t> drops;
+  for (size_t i = CORRUPTION_INTERVAL; i < FRAME_COUNT; i += CORRUPTION_INTERVAL) {
+    auto offset = frame_offsets[i] + rng() % (frame_offsets[i + 1] - frame_offsets[i]);
+    if (i % (CORRUPTION_INTERVAL * 2)) {
+      corrupted[offset] ^= 1 << (rng() % 8);
+    } else {
+      drops.push_back(offset);
+    }
+  }
+  for (auto it = drops.rbegin(); it != drops.rend(); it++) {
+    corrupted.erase(corrupted.begin() + *it);
+  }
+
+  rc::FrameDecoder decoder;
+  auto begin = bench_clock::now();
+  for (auto byte : corrupted) {
+    decoder.push(byte);
+  }
+  auto seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+
+  auto& stats = decoder.stats();
+  auto corruptions = FRAME_COUNT / CORRUPTION_INTERVAL - 1;
+  printf("framing[corrupted]: %.1fMB/s corruptions=%d frames_lost=%u (%.2f/corruption) skipped_bytes=%u (%.1f/corruption) crc_errors=%u length_errors=%u\n",
+    corrupted.size() / seconds / 1e6, corruptions, FRAME_COUNT - stats.frames, (double)(FRAME_COUNT - stats.frames) / corruptions,
+    stats.skipped_bytes, (double)stats.skipped_bytes / corruptions, stats.crc_errors, stats.length_errors);
+
+  return 0;
+}
+
+// usb bytes per second of one second of the usual traffic, whole events against the active union member only.
+// rates are the client and firmware defaults: channels every 4ms tick, a ping every 100ms and its pong,
+// link stats and telemetry every 500ms, plus the four parameter reports of a connect.
+static int benchEncoding() {
+  auto run = [](const char* direction, auto registry, const auto& events) {
+    using Registry = decltype(registry);
+    using Event = std::decay_t<decltype(events[0])>;
+
+    std::vector<uint8_t> stream;
+    size_t full = 0;
+    uint8_t frame[rc::FRAME_MAX_SIZE];
+    for (auto& event : events) {
+      auto len = Registry::encode(event, frame);
+      stream.insert(stream.end(), frame, frame + len);
+      full += rc::FRAME_OVERHEAD + sizeof(Event);
+    }
+
+    // everything has to come back out as it went in
+    rc::FrameDecoder decoder;
+    Event decoded;
+    size_t next = 0;
+    auto ok = true;
+    for (auto byte : stream) {
+      if (decoder.push(byte)) {
+        ok &= Registry::decode(decoder.payload(), decoder.payloadSize(), decoded) && decoded.type == events[next].type &&
+              memcmp(&decoded, &events[next], Registry::sizeOf(decoded.type)) == 0;
+        next++;
+      }
+    }
+    ok &= next == events.size();
+
+    printf("encoding[%s]: events=%zu/s full=%zuB/s compact=%zuB/s saved=%.0f%%%s\n",
+      direction, events.size(), full, stream.size(), 100.0 * (full - stream.size()) / full, ok ? "" : " ROUNDTRIP FAILED");
+    return ok;
+  };
+
+  std::mt19937 rng{1616};
+  auto randomize = [&](auto& payload) {
+    auto bytes = (uint8_t*)&payload;
+    for (size_t i = 0; i < sizeof(payload); i++) {
+      bytes[i] = rng();
+    }
+  };
+
+  std::vector<rc::GamepadEvent> host_events;
+  for (int tick = 0; tick < 250; tick++) {
+    auto channels = rc::msg::Channels::make({});
+    randomize(channels.channels);
+    host_events.push_back(channels);
+    if (tick % 25 == 0) {
+      host_events.push_back(rc::msg::Ping::make({(uint32_t)tick, tick * 4'000'000ll, 1500}));
+    }
+  }
+
+  std::vector<rc::RemoteEvent> bridge_events;
+  for (int ms = 0; ms < 1000; ms += 100) {
+    if (ms % 500 == 0) {
+      auto link_stats = rc::RemoteEvent{rc::RemoteEvent::RC_EVENT_REPORT_LINK_STATS};
+      randomize(link_stats.report_link_stats);
+      bridge_events.push_back(link_stats);
+      auto telemetry = rc::RemoteEvent{rc::RemoteEvent::RC_EVENT_REPORT_TELEMETRY};
+      randomize(telemetry.report_telemetry);
+      bridge_events.push_back(telemetry);
+    }
+    auto pong = rc::msg::Pong::make({});
+    randomize(pong.pong);
+    bridge_events.push_back(pong);
+  }
+  for (uint8_t parameter : {rc::PARAM_PACKET_RATE, rc::PARAM_TLM_RATIO, rc::PARAM_MAX_POWER, rc::PARAM_LINK_MODE}) {
+    bridge_events.push_back(rc::msg::ReportParameter::make({parameter, 1}));
+  }
+
+  auto ok = true;
+  ok &= run("host->bridge", rc::GamepadMessages{}, host_events);
+  ok &= run("bridge->host", rc::RemoteMessages{}, bridge_events);
+  return ok ? 0 : 1;
+}
+
+// the serialib::readBytes loop before it waited in poll(), kept to compare against
+static int legacyReadBytes(int fd, void* buffer, unsigned int maxNbBytes, unsigned int timeOut_ms, unsigned int sleepDuration_us = 100) {
+  timeOut timer;
+  timer.initTimer();
+  unsigned int NbByteRead = 0;
+  while (timer.elapsedTime_ms() < timeOut_ms || timeOut_ms == 0) {
+    unsigned char* Ptr = (unsigned char*)buffer + NbByteRead;
+    int Ret = read(fd, (void*)Ptr, maxNbBytes - NbByteRead);
+    if (Ret == -1) {
+      return -2;
+    }
+    if (Ret > 0) {
+      NbByteRead += Ret;
+      if (NbByteRead >= maxNbBytes) {
+        return NbByteRead;
+      }
+    }
+    usleep(sleepDuration_us);
+  }
+  return NbByteRead;
+}
+
+static bench_clock::duration threadCPUTime() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+// a writer sends timestamped 16 byte packets into a pty at the 250Hz telemetry rate,
+// the reader receives them through serialib the way the client does.
+// wakeup latency is the time from write() to the packet being complete on the reader side.
+static int benchSerialRead() {
+  struct Packet {
+    bench_clock::rep written_at;
+    uint64_t sequence;
+  };
+
+  enum ReadMode {
+    READ_LEGACY,
+    READ_BYTES,
+    READ_AVAILABLE,
+  };
+
+  auto run = [](const char* name, ReadMode mode, std::chrono::seconds duration) {
+    auto master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+      printf("serial-read[%s]: failed to open a pty: %s\n", name, strerror(errno));
+      return false;
+    }
+
+    serialib serial;
+    if (serial.openDevice(ptsname(master), 115200) != 1) {
+      printf("serial-read[%s]: failed to open %s\n", name, ptsname(master));
+      close(master);
+      return false;
+    }
+
+    std::atomic<bool> running = true;
+    uint64_t written = 0;
+
+    std::thread writer{[&]() {
+      pinToCPU(1);
+
+      Packet packet{};
+      auto next = bench_clock::now();
+      while (running.load(std::memory_order_relaxed)) {
+        next += std::chrono::milliseconds{4};
+        std::this_thread::sleep_until(next);
+
+        packet.sequence = written;
+        packet.written_at = bench_clock::now().time_since_epoch().count();
+        if (::write(master, &packet, sizeof(packet)) == sizeof(packet)) {
+          written++;
+        }
+      }
+    }};
+
+    pinToCPU(2);
+
+    LatencyHistogram latency;
+    uint64_t received = 0;
+
+    std::array<uint8_t, 256> ring;
+    unsigned int head = 0;
+    unsigned int tail = 0;
+    Packet packet;
+
+    auto cpu_begin = threadCPUTime();
+    auto begin = bench_clock::now();
+    auto end = begin + duration;
+    while (bench_clock::now() < end) {
+      int len = 0;
+      switch (mode) {
+      case READ_LEGACY:
+        len = legacyReadBytes(serial.fileDescriptor(), &packet, sizeof(packet), 100);
+        break;
+      case READ_BYTES:
+        len = serial.readBytes(&packet, sizeof(packet), 100);
+        break;
+      case READ_AVAILABLE: {
+        pollfd pfd{serial.fileDescriptor(), POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) {
+          continue;
+        }
+        if (serial.readAvailable(ring.data(), ring.size(), &head, tail) < 0) {
+          len = -2;
+          break;
+        }
+        while (head - tail >= sizeof(packet)) {
+          auto bytes = (uint8_t*)&packet;
+          for (size_t i = 0; i < sizeof(packet); i++) {
+            bytes[i] = ring[tail++ % ring.size()];
+          }
+          latency.record(bench_clock::now() - bench_clock::time_point{bench_clock::duration{packet.written_at}});
+          received++;
+        }
+        continue;
+      }
+      }
+
+      if (len < 0) {
+        break;
+      }
+      if (len == sizeof(packet)) {
+        latency.record(bench_clock::now() - bench_clock::time_point{bench_clock::duration{packet.written_at}});
+        received++;
+      }
+    }
+    auto cpu = threadCPUTime() - cpu_begin;
+    auto seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+
+    running = false;
+    writer.join();
+    serial.closeDevice();
+    close(master);
+
+    printf("serial-read[%s]: packets=%llu/%llu cpu=%.1fms/s latency[p50=%uus p99=%uus max=%uus]\n",
+      name, (unsigned long long)received, (unsigned long long)written,
+      std::chrono::duration<double, std::milli>(cpu).count() / seconds,
+      latency.percentile(50), latency.percentile(99), latency.max());
+
+    // the last packet may still be in flight when the writer stops
+    return received + 1 >= written;
+  };
+
+  auto ok = true;
+  ok &= run("legacy-usleep", READ_LEGACY, std::chrono::seconds{3});
+  ok &= run("readBytes-poll", READ_BYTES, std::chrono::seconds{3});
+  ok &= run("readAvailable-ring", READ_AVAILABLE, std::chrono::seconds{3});
+  return ok ? 0 : 1;
+}
+
+// the full RCBrain batching and framing path into each stream transport, with the bridge side in a thread of this process.
+// udp has its own benchmark with loss and jitter, see benchUDPLink().
+// the send time travels in the first four axes of a PAD_EVENT_CHANNELS event, so latency is send() to decoded by the bridge.
+static int benchTransport() {
+  using BridgeFD = std::function<int()>;
+
+  auto run = [](std::string_view name, std::string_view load, std::unique_ptr<RCTransport> transport, const BridgeFD& bridgeFD, std::chrono::nanoseconds pace) {
+    RCBrain brain;
+    if (!brain.open(std::move(transport))) {
+      printf("transport[%.*s]: failed to open\n", (int)name.size(), name.data());
+      return false;
+    }
+
+    // bridge side, only valid once the client side is open
+    auto bridge_fd = bridgeFD();
+
+    std::atomic<bool> running = true;
+    LatencyHistogram latency;
+    uint64_t received = 0;
+
+    std::thread bridge{[&]() {
+      pinToCPU(1);
+
+      rc::FrameDecoder decoder;
+      rc::GamepadEvent gamepad_event;
+      uint8_t buffer[4096];
+      pollfd pfd{bridge_fd, POLLIN, 0};
+      while (running.load(std::memory_order_relaxed)) {
+        if (poll(&pfd, 1, 100) <= 0) {
+          continue;
+        }
+        auto len = ::read(bridge_fd, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < len; i++) {
+          if (decoder.push(buffer[i]) && decoder.type() == rc::FRAME_GAMEPAD_EVENT && decoder.payloadAs(gamepad_event)) {
+            int64_t sent_at;
+            memcpy(&sent_at, gamepad_event.channels.axes, sizeof(sent_at));
+            latency.record(bench_clock::now() - bench_clock::time_point{bench_clock::duration{sent_at}});
+            received++;
+          }
+        }
+      }
+    }};
+
+    pinToCPU(2);
+
+    rc::GamepadEvent gamepad_event{};
+    gamepad_event.type = rc::GamepadEvent::PAD_EVENT_CHANNELS;
+    uint64_t sent = 0;
+
+    auto begin = bench_clock::now();
+    auto next = begin;
+    auto end = begin + std::chrono::seconds{2};
+    while (bench_clock::now() < end) {
+      if (pace.count()) {
+        next += pace;
+        std::this_thread::sleep_until(next);
+      }
+
+      int64_t sent_at = bench_clock::now().time_since_epoch().count();
+      memcpy(gamepad_event.channels.axes, &sent_at, sizeof(sent_at));
+      brain.send({&gamepad_event, 1});
+      sent++;
+    }
+    auto seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+    // one event per send(), so every failed write is one event the bridge never saw
+    auto write_errors = brain.takeStats().write_errors;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    running = false;
+    bridge.join();
+    ::close(bridge_fd);
+
+    printf("transport[%.*s/%.*s]: sent=%.0f/s received=%llu/%llu write_errors=%llu latency[p50=%uus p99=%uus max=%uus]\n",
+      (int)name.size(), name.data(), (int)load.size(), load.data(), sent / seconds, (unsigned long long)received, (unsigned long long)sent,
+      (unsigned long long)write_errors, latency.percentile(50), latency.percentile(99), latency.max());
+
+    // everything written to a stream has to arrive
+    return received + write_errors == sent;
+  };
+
+  auto runAll = [&](std::string_view load, std::chrono::nanoseconds pace) {
+    auto ok = true;
+
+    {
+      auto transport = std::make_unique<RCLoopbackTransport>();
+      auto loopback = transport.get();
+      ok &= run("loopback", load, std::move(transport), [&]() { return dup(loopback->peerFD()); }, pace);
+    }
+
+    {
+      auto path = std::format("/tmp/rc-bench-{}.sock", getpid());
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      memcpy(addr.sun_path, path.data(), path.size());
+      auto listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      unlink(path.data());
+      if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listen_fd, 1) == 0) {
+        ok &= run("unix", load, RCTransport::create("unix:" + path), [&]() { return accept(listen_fd, nullptr, nullptr); }, pace);
+      }
+      ::close(listen_fd);
+      unlink(path.data());
+    }
+
+    return ok;
+  };
+
+  auto ok = true;
+  ok &= runAll("flat-out", std::chrono::nanoseconds{0});
+  ok &= runAll("paced-250hz", std::chrono::milliseconds{4});
+  return ok ? 0 : 1;
+}
+
+// channels at 250Hz through RCUDPTransport, a lossy relay and a bridge thread playing them out of a
+// UDPLinkReceiver. latency is send() to played by the bridge, rate the distinct channel updates it played.
+static int benchUDPLink() {
+  struct Scenario {
+    const char* name;
+    int loss_percent;
+    std::chrono::microseconds delay;
+    std::chrono::microseconds jitter;
+    uint8_t redundancy;
+  };
+
+  auto nowUs = []() -> uint32_t {
+    return std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now().time_since_epoch()).count();
+  };
+
+  auto bindLoopback = [](sockaddr_in& addr) {
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    auto fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(fd, (sockaddr*)&addr, &addr_len) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  };
+
+  auto run = [&](const Scenario& scenario) {
+    sockaddr_in bridge_addr, relay_addr;
+    auto bridge_fd = bindLoopback(bridge_addr);
+    auto relay_fd = bindLoopback(relay_addr);
+    if (bridge_fd < 0 || relay_fd < 0) {
+      printf("udp-link[%s]: failed to bind\n", scenario.name);
+      return false;
+    }
+
+    RCBrain brain;
+    if (!brain.open(std::make_unique<RCUDPTransport>("127.0.0.1", std::to_string(ntohs(relay_addr.sin_port)), scenario.redundancy))) {
+      printf("udp-link[%s]: failed to open\n", scenario.name);
+      return false;
+    }
+
+    std::atomic<bool> running = true;
+
+    // drops and delays datagrams on their way to the bridge, jitter reorders them
+    std::thread relay{[&]() {
+      struct Delayed {
+        bench_clock::time_point release_at;
+        std::vector<uint8_t> datagram;
+        bool operator<(const Delayed& other) const {
+          return release_at > other.release_at;
+        }
+      };
+
+      std::mt19937 rng{2024};
+      std::priority_queue<Delayed> queue;
+      uint8_t buffer[1500];
+      pollfd pfd{relay_fd, POLLIN, 0};
+      while (running.load(std::memory_order_relaxed)) {
+        auto timeout = std::chrono::milliseconds{10};
+        if (!queue.empty()) {
+          timeout = std::clamp(std::chrono::ceil<std::chrono::milliseconds>(queue.top().release_at - bench_clock::now()), std::chrono::milliseconds{0}, timeout);
+        }
+        poll(&pfd, 1, timeout.count());
+
+        ssize_t len;
+        while ((len = ::recv(relay_fd, buffer, sizeof(buffer), 0)) > 0) {
+          if ((int)(rng() % 100) < scenario.loss_percent) {
+            continue;
+          }
+          auto jitter = scenario.jitter.count() ? std::chrono::microseconds{rng() % scenario.jitter.count()} : std::chrono::microseconds{0};
+          queue.push({bench_clock::now() + scenario.delay + jitter, {buffer, buffer + len}});
+        }
+
+        while (!queue.empty() && queue.top().release_at <= bench_clock::now()) {
+          auto& datagram = queue.top().datagram;
+          sendto(relay_fd, datagram.data(), datagram.size(), 0, (sockaddr*)&bridge_addr, sizeof(bridge_addr));
+          queue.pop();
+        }
+      }
+    }};
+
+    LatencyHistogram latency;
+    uint64_t played = 0;
+    rc::UDPLinkReceiver receiver;
+
+    std::thread bridge{[&]() {
+      rc::FrameDecoder decoder;
+      rc::GamepadEvent gamepad_event;
+      uint8_t buffer[1500];
+      pollfd pfd{bridge_fd, POLLIN, 0};
+      while (running.load(std::memory_order_relaxed)) {
+        timespec timeout{0, 10'000'000};
+        uint32_t playout_us = 0;
+        if (receiver.nextPlayout(playout_us)) {
+          auto wait_us = std::max<int32_t>((int32_t)(playout_us - nowUs()), 0);
+          timeout = {wait_us / 1'000'000, (wait_us % 1'000'000) * 1000};
+        }
+        ppoll(&pfd, 1, &timeout, nullptr);
+
+        ssize_t len;
+        while ((len = ::recv(bridge_fd, buffer, sizeof(buffer), 0)) >= 0) {
+          receiver.push(buffer, len, nowUs());
+        }
+
+        receiver.pop(nowUs(), [&](const uint8_t* payload, uint8_t payload_len) {
+          for (uint8_t i = 0; i < payload_len; i++) {
+            if (decoder.push(payload[i]) && decoder.type() == rc::FRAME_GAMEPAD_EVENT && decoder.payloadAs(gamepad_event)) {
+              int64_t sent_at;
+              memcpy(&sent_at, gamepad_event.channels.axes, sizeof(sent_at));
+              latency.record(bench_clock::now() - bench_clock::time_point{bench_clock::duration{sent_at}});
+              played++;
+            }
+          }
+          return true;
+        });
+      }
+    }};
+
+    rc::GamepadEvent gamepad_event{};
+    gamepad_event.type = rc::GamepadEvent::PAD_EVENT_CHANNELS;
+    uint64_t sent = 0;
+
+    auto begin = bench_clock::now();
+    auto next = begin;
+    auto end = begin + std::chrono::seconds{3};
+    while (next < end) {
+      next += std::chrono::milliseconds{4};
+      std::this_thread::sleep_until(next);
+
+      int64_t sent_at = bench_clock::now().time_since_epoch().count();
+      memcpy(gamepad_event.channels.axes, &sent_at, sizeof(sent_at));
+      brain.send({&gamepad_event, 1});
+      sent++;
+    }
+    auto seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+
+    std::this_thread::sleep_for(scenario.delay + scenario.jitter + std::chrono::milliseconds{50});
+    running = false;
+    relay.join();
+    bridge.join();
+    ::close(relay_fd);
+    ::close(bridge_fd);
+
+    auto& stats = receiver.stats();
+    printf("udp-link[%s]: rate=%.0f/%.0fHz played=%llu/%llu latency[p50=%uus p99=%uus max=%uus] recovered=%u lost=%u late=%u jitter=%uus delay=%uus\n",
+      scenario.name, played / seconds, sent / seconds, (unsigned long long)played, (unsigned long long)sent,
+      latency.percentile(50), latency.percentile(99), latency.max(),
+      stats.recovered, stats.lost, stats.late, receiver.jitterUs(), receiver.delayUs());
+
+    return played > 0;
+  };
+
+  Scenario scenarios[] = {
+    {"clean", 0, {}, {}, 2},
+    {"loss-5%/no-redundancy", 5, {}, {}, 1},
+    {"loss-5%", 5, {}, {}, 2},
+    {"loss-5%+jitter-4ms", 5, std::chrono::milliseconds{2}, std::chrono::milliseconds{4}, 2},
+    {"loss-20%+jitter-4ms/no-redundancy", 20, std::chrono::milliseconds{2}, std::chrono::milliseconds{4}, 1},
+    {"loss-20%+jitter-4ms", 20, std::chrono::milliseconds{2}, std::chrono::milliseconds{4}, 2},
+    {"loss-20%+jitter-4ms/redundancy-3", 20, std::chrono::milliseconds{2}, std::chrono::milliseconds{4}, 3},
+  };
+
+  auto ok = true;
+  for (auto& scenario : scenarios) {
+    ok &= run(scenario);
+  }
+  return ok ? 0 : 1;
+}
+
+int runBenchmark(std::string_view name) {
+  if (name == "spsc") {
+    return benchSPSC();
+  }
+  if (name == "framing") {
+    return benchFraming();
+  }
+  if (name == "encoding") {
+    return benchEncoding();
+  }
+  if (name == "serial-read") {
+    return benchSerialRead();
+  }
+  if (name == "transport") {
+    return benchTransport();
+  }
+  if (name == "udp-link") {
+    return benchUDPLink();
+  }
+
+  printf("unknown benchmark: %.*s\n", (int)name.size(), name.data());
+  printf("available: spsc, framing, encoding, serial-read, transport, udp-link\n");
+  return 1;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string_view>
+
+// host-side micro benchmarks, selected with --bench <name>.
+// each one prints its results and returns the process exit code.
+int runBenchmark(std::string_view name);
@@ -0,0 +1,451 @@
+#include "headless.hpp"
+#include "EventLoop.hpp"
+#include "LatencyHistogram.hpp"
+#include "RCBrain.hpp"
+#include "RCInput.hpp"
+#include "RCChannelMap.hpp"
+#include "RCHidraw.hpp"
+#include "RCParameters.hpp"
+#include "RCTransmitter.hpp"
+#include "RCTransport.hpp"
+#include "rc-framing.hpp"
+#include "rc-messages.hpp"
+#include "rc-protocol.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <format>
+#include <new>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using headless_clock = std::chrono::steady_clock;
+
+#ifdef RC_COUNT_ALLOCATIONS
+// counts every allocation of the process, one relaxed increment on top of malloc.
+// it replaces the global operator new, so only builds configured with -DRC_COUNT_ALLOCATIONS=ON have it
+static std::atomic<uint64_t> allocations = 0;
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+std::optional<uint64_t> allocationCount() {
+  return allocations.load(std::memory_order_relaxed);
+}
+#else
+std::optional<uint64_t> allocationCount() {
+  return std::nullopt;
+}
+#endif
+
+static std::chrono::nanoseconds cpuTime(clockid_t clock_id) {
+  timespec ts;
+  clock_gettime(clock_id, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+// stands in for the esp32 on the other end of the loopback: answers hellos, pings and parameter reads
+// and sends link stats every 500ms, like the firmware does
+class HeadlessBridge {
+private:
+  int _fd = -1;
+  std::thread _thread;
+  std::atomic<bool> _running = false;
+  std::chrono::nanoseconds _cpu_time{};
+  uint64_t _events = 0;
+  // channels and button events as they arrived, fnv-1a over the frame payloads
+  std::atomic<uint64_t> _input_events = 0;
+  std::atomic<uint64_t> _channels = 0;
+  uint64_t _input_hash = 0xCBF29CE484222325;
+
+  void hashInput(const uint8_t* payload, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+      _input_hash = (_input_hash ^ payload[i]) * 0x100000001B3;
+    }
+    _input_events.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static uint32_t micros() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(headless_clock::now().time_since_epoch()).count();
+  }
+
+  void write(const rc::RemoteEvent& remote_event) {
+    uint8_t frame[rc::FRAME_MAX_SIZE];
+    ::write(_fd, frame, rc::RemoteMessages::encode(remote_event, frame));
+  }
+
+  void sendHello() {
+    rc::Hello hello{rc::PROTOCOL_VERSION, rc::PROTOCOL_MIN_VERSION, rc::FRAME_MAX_PAYLOAD_SIZE, 0, rc::GamepadMessages::acceptedEvents(), rc::FEATURE_BATCHING};
+    uint8_t frame[rc::FRAME_MAX_SIZE];
+    ::write(_fd, frame, rc::encodeFrame(rc::FRAME_HELLO, hello, frame));
+  }
+
+  void run() {
+    rc::FrameDecoder decoder;
+    rc::GamepadEvent gamepad_event;
+    uint8_t parameters[UINT8_MAX + 1] = {};
+    uint8_t buffer[4096];
+
+    pollfd pfd{_fd, POLLIN, 0};
+    auto next_report = headless_clock::now();
+    while (_running.load(std::memory_order_relaxed)) {
+      auto ready = poll(&pfd, 1, 50);
+
+      if (headless_clock::now() >= next_report) {
+        next_report += std::chrono::milliseconds{500};
+        write(rc::msg::ReportLinkStats::make({}));
+      }
+
+      if (ready <= 0) {
+        continue;
+      }
+
+      auto len = ::read(_fd, buffer, sizeof(buffer));
+      for (ssize_t i = 0; i < len; i++) {
+        if (!decoder.push(buffer[i])) {
+          continue;
+        }
+
+        if (decoder.type() == rc::FRAME_HELLO) {
+          rc::Hello hello;
+          if (decoder.payloadAs(hello) && (hello.flags & rc::HELLO_REQUEST)) {
+            sendHello();
+          }
+          continue;
+        }
+
+        if (decoder.type() != rc::FRAME_GAMEPAD_EVENT || !rc::GamepadMessages::decode(decoder.payload(), decoder.payloadSize(), gamepad_event)) {
+          continue;
+        }
+        _events++;
+
+        rc::GamepadMessages::dispatch(gamepad_event, rc::Handlers{
+          [&](rc::msg::Channels, const auto&) {
+            hashInput(decoder.payload(), decoder.payloadSize());
+            _channels.fetch_add(1, std::memory_order_release);
+          },
+          [&](rc::msg::CrsfChannels, const auto&) {
+            hashInput(decoder.payload(), decoder.payloadSize());
+            _channels.fetch_add(1, std::memory_order_release);
+          },
+          [&](rc::msg::ButtonDown, const auto&) {
+            hashInput(decoder.payload(), decoder.payloadSize());
+          },
+          [&](rc::msg::ButtonUp, const auto&) {
+            hashInput(decoder.payload(), decoder.payloadSize());
+          },
+          [&](rc::msg::Ping, const auto& ping) {
+            auto now = micros();
+            write(rc::msg::Pong::make({ping.sequence, ping.sent_at_ns, ping.sample_age_us, now, now, micros()}));
+          },
+          [&](rc::msg::GetParameter, const auto& get_parameter) {
+            write(rc::msg::ReportParameter::make({get_parameter.parameter, parameters[get_parameter.parameter]}));
+          },
+          [&](rc::msg::SetParameter, const auto& set_parameter) {
+            parameters[set_parameter.parameter] = set_parameter.value;
+          },
+        });
+      }
+    }
+
+    _cpu_time = ::cpuTime(CLOCK_THREAD_CPUTIME_ID);
+  }
+
+public:
+  ~HeadlessBridge() {
+    stop();
+  }
+
+  void start(int fd) {
+    _fd = fd;
+    _running = true;
+    _thread = std::thread{&HeadlessBridge::run, this};
+  }
+
+  void stop() {
+    _running = false;
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+  }
+
+  // valid after stop()
+  inline std::chrono::nanoseconds cpuTime() const {
+    return _cpu_time;
+  }
+
+  inline uint64_t events() const {
+    return _events;
+  }
+
+  inline uint64_t channels() const {
+    return _channels.load(std::memory_order_acquire);
+  }
+
+  inline uint64_t inputEvents() const {
+    return _input_events.load(std::memory_order_relaxed);
+  }
+
+  // valid after stop()
+  inline uint64_t inputHash() const {
+    return _input_hash;
+  }
+};
+
+int runHeadless(const RCHeadlessOptions& options) {
+  RCInputReplay replay;
+  if (!options.replay_path.empty() && !replay.load(options.replay_path)) {
+    printf("headless: failed to load the input recording %.*s\n", (int)options.replay_path.size(), options.replay_path.data());
+    return 1;
+  }
+  auto replaying = !options.replay_path.empty();
+  auto replay_fast = replaying && options.replay_fast;
+
+  RCHidrawInput hidraw;
+  if (!options.hid_replay_path.empty() && !hidraw.openReplay(options.hid_replay_path)) {
+    printf("headless: failed to load the hid capture %.*s\n", (int)options.hid_replay_path.size(), options.hid_replay_path.data());
+    return 1;
+  }
+  auto hid_replaying = !options.hid_replay_path.empty();
+
+  auto transport = std::make_unique<RCLoopbackTransport>();
+  auto loopback = transport.get();
+
+  RCBrain brain;
+  if (!brain.open(std::move(transport))) {
+    printf("headless: failed to open the loopback transport\n");
+    return 1;
+  }
+
+  HeadlessBridge bridge;
+  bridge.start(loopback->peerFD());
+
+  RCParameters parameters{brain};
+  RCTransmitter transmitter{brain};
+  RCChannelMap channel_map;
+  channel_map.loadFromFile(options.input_config);
+  RCInput input{brain, transmitter, channel_map};
+  if (hid_replaying) {
+    transmitter.setSampler(hidraw, channel_map);
+  }
+  EventLoop loop;
+
+  uint64_t remote_events = 0;
+  LatencyHistogram rtt;
+  rc::RemoteEvent remote_event;
+  loop.add(brain.fd(), EPOLLIN, [&](uint32_t) {
+    brain.read(remote_event, [&]() {
+      remote_events++;
+      rc::RemoteMessages::dispatch(remote_event, rc::Handlers{
+        [&](rc::msg::Pong, const auto& pong) {
+          auto now = headless_clock::now().time_since_epoch().count();
+          rtt.record(std::chrono::nanoseconds{now - pong.sent_at_ns});
+        },
+        [&](rc::msg::ReportParameter, const auto& report_parameter) {
+          parameters.onReport(report_parameter.parameter, report_parameter.value);
+        },
+        [&](rc::msg::ReportArmed, const auto& report_armed) {
+          parameters.setArmed(report_armed.armed);
+        },
+      });
+    });
+  });
+
+  auto begin = headless_clock::now();
+
+  // the recording or sticks sweeping at different rates, applied every input tick like pollSDLEvents() does with live events
+  LatencyHistogram input_tick_latency;
+  RCGamepadState hid_state;
+  auto hid_done = false;
+  TimerFD end_timer;
+  TimerFD input_timer;
+  input_timer.start(std::chrono::milliseconds{4});
+  loop.add(input_timer.fd(), EPOLLIN, [&](uint32_t) {
+    if (!input_timer.consume()) {
+      return;
+    }
+    auto now = headless_clock::now();
+    input_tick_latency.record(now - input_timer.lastExpiry());
+
+    if (hid_replaying) {
+      if (RCGamepadState state; hidraw.take(state)) {
+        state.diff(hid_state, [&](const RCInputEvent& input_event) {
+          input.apply(input_event, headless_clock::time_point{std::chrono::nanoseconds{state.read_at_ns}});
+        });
+        hid_state = state;
+      }
+      input.evaluate();
+      // the last answers of the bridge still arrive before the end timer
+      if (hidraw.done() && !hid_done) {
+        hid_done = true;
+        end_timer.startAt(now + std::chrono::milliseconds{200});
+      }
+      return;
+    }
+
+    if (replaying) {
+      replay.playUntil(now - begin, [&](const RCInputEvent& input_event, std::chrono::nanoseconds) {
+        input.apply(input_event, now);
+      });
+      input.evaluate();
+      return;
+    }
+
+    auto t = std::chrono::duration<double>(now - begin).count();
+    for (uint8_t axis = 0; axis < rc::SDL_GAMEPAD_AXIS_RIGHT_TRIGGER; axis++) {
+      auto value = (int16_t)(INT16_MAX * std::sin(2 * M_PI * (0.5 + 0.25 * axis) * t));
+      input.apply({0, rc::GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION, axis, value}, now);
+    }
+    input.evaluate();
+  });
+
+  TimerFD parameters_timer;
+  parameters_timer.start(std::chrono::milliseconds{100});
+  loop.add(parameters_timer.fd(), EPOLLIN, [&](uint32_t) {
+    parameters_timer.consume();
+    parameters.tick();
+  });
+
+  // the transmitter publishes a window per second, collected often enough that none is overwritten
+  RCTransmitterStats channels;
+  auto collect = [&]() {
+    channels.merge(transmitter.takeReport());
+  };
+  TimerFD collect_timer;
+  collect_timer.start(std::chrono::milliseconds{250});
+  loop.add(collect_timer.fd(), EPOLLIN, [&](uint32_t) {
+    collect_timer.consume();
+    collect();
+  });
+
+  std::optional<uint64_t> warmup_allocations;
+  TimerFD warmup_timer;
+  warmup_timer.startAt(begin + options.warmup);
+  loop.add(warmup_timer.fd(), EPOLLIN, [&](uint32_t) {
+    warmup_timer.consume();
+    warmup_allocations = allocationCount();
+  });
+
+  // channels every period of recording time, the bridge is given time to catch up so no write fails on a full socket
+  auto playFast = [&]() {
+    uint64_t ticks = 0;
+    for (std::chrono::nanoseconds elapsed{0}; !replay.done(); elapsed += options.transmitter.period) {
+      replay.playUntil(elapsed, [&](const RCInputEvent& input_event, std::chrono::nanoseconds offset) {
+        input.apply(input_event, begin + offset);
+      });
+      input.evaluate();
+      transmitter.transmitNow();
+      ticks++;
+
+      if (ticks % 64 == 0) {
+        auto deadline = headless_clock::now() + std::chrono::seconds{1};
+        while (bridge.channels() < ticks && headless_clock::now() < deadline) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    return ticks;
+  };
+
+  // a replay lasts as long as the recording, plus a moment for the last answers of the bridge
+  auto end = begin + options.warmup + options.duration;
+  if (replaying) {
+    end = begin + (replay_fast ? std::chrono::nanoseconds{0} : replay.length()) + std::chrono::milliseconds{200};
+  }
+  if (hid_replaying) {
+    // until the capture ends, the input tick moves the end timer then
+    end = begin + std::chrono::hours{24};
+  }
+  end_timer.startAt(end);
+  loop.add(end_timer.fd(), EPOLLIN, [&](uint32_t) {
+    end_timer.consume();
+    loop.stop();
+  });
+
+  auto start_allocations = allocationCount();
+  // runs shorter than the warmup count from the start
+  warmup_allocations = start_allocations;
+  auto start_process_cpu = cpuTime(CLOCK_PROCESS_CPUTIME_ID);
+  auto start_main_cpu = cpuTime(CLOCK_THREAD_CPUTIME_ID);
+
+  uint64_t replay_ticks = 0;
+  if (replay_fast) {
+    replay_ticks = playFast();
+    end_timer.startAt(headless_clock::now() + std::chrono::milliseconds{200});
+  } else {
+    transmitter.start(options.transmitter);
+  }
+  hidraw.start();
+  loop.run();
+  hidraw.stop();
+  transmitter.stop();
+
+  auto end_allocations = allocationCount();
+  auto seconds = std::chrono::duration<double>(headless_clock::now() - begin).count();
+  auto steady_seconds = std::max(seconds - std::chrono::duration<double>(options.warmup).count(), 0.001);
+  auto main_cpu = cpuTime(CLOCK_THREAD_CPUTIME_ID) - start_main_cpu;
+  bridge.stop();
+  auto process_cpu = cpuTime(CLOCK_PROCESS_CPUTIME_ID) - start_process_cpu;
+  auto bridge_cpu = bridge.cpuTime();
+  auto hid_cpu = hidraw.cpuTime();
+  auto hid_stats = hidraw.takeReport();
+  collect();
+
+  auto ms_per_second = [&](std::chrono::nanoseconds cpu) {
+    return std::chrono::duration<double, std::milli>(cpu).count() / seconds;
+  };
+  auto histogram = [](const LatencyHistogram& h) {
+    return std::format("{{\"p50_us\":{},\"p99_us\":{},\"max_us\":{}}}", h.percentile(50), h.percentile(99), h.max());
+  };
+
+  std::string allocations_json = "null";
+  if (end_allocations) {
+    allocations_json = std::format("{{\"total\":{},\"steady_state\":{},\"steady_state_per_sec\":{:.2f}}}",
+      *end_allocations - *start_allocations, *end_allocations - *warmup_allocations, (*end_allocations - *warmup_allocations) / steady_seconds);
+  }
+
+  // a fast replay sends no pings
+  auto link_ok = brain.linkState() == LINK_COMPATIBLE && (replay_fast || rtt.count() > 0);
+
+  // one line, everything else printed before it is diagnostics
+  printf("%s\n", std::format(
+    "{{\"seconds\":{:.3f},\"link_ok\":{},"
+    "\"loop\":{{\"iterations_per_sec\":{:.1f},\"input_tick_latency\":{}}},"
+    "\"cpu_ms_per_sec\":{{\"process\":{:.3f},\"main\":{:.3f},\"transmitter\":{:.3f},\"bridge_sim\":{:.3f},\"hidraw\":{:.3f}}},"
+    "\"channels\":{{\"ticks\":{},\"missed\":{},\"lateness\":{},\"interval_error\":{},\"input_latency\":{},\"sample_age\":{}}},"
+    "\"brain\":{{\"events\":{},\"writes\":{},\"write_errors\":{},\"dropped\":{},\"bridge_events\":{}}},"
+    "\"remote\":{{\"events\":{},\"pongs\":{},\"rtt\":{}}},"
+    "\"hid\":{{\"reports\":{},\"invalid\":{},\"lost\":{},\"interval\":{}}},"
+    "\"replay\":{{\"mode\":\"{}\",\"events\":{},\"fast_ticks\":{},\"input_events\":{},\"output_hash\":\"{:016x}\"}},"
+    "\"allocations\":{}}}",
+    seconds, link_ok,
+    loop.wakeups() / seconds, histogram(input_tick_latency),
+    ms_per_second(process_cpu), ms_per_second(main_cpu), ms_per_second(process_cpu - main_cpu - bridge_cpu - hid_cpu), ms_per_second(bridge_cpu), ms_per_second(hid_cpu),
+    channels.ticks, channels.missed_ticks, histogram(channels.lateness), histogram(channels.interval_error), histogram(channels.input_latency), histogram(channels.sample_age),
+    channels.brain.events, channels.brain.writes, channels.brain.write_errors, brain.dropped(), bridge.events(),
+    remote_events, rtt.count(), histogram(rtt),
+    hid_stats.reports, hid_stats.invalid, hid_stats.lost, histogram(hid_stats.interval),
+    replay_fast ? "fast" : replaying ? "realtime" : "none", replay.events().size(), replay_ticks, bridge.inputEvents(), bridge.inputHash(),
+    allocations_json).c_str());
+
+  return link_ok ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "RCTransmitter.hpp"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+struct RCHeadlessOptions {
+  std::chrono::seconds duration{10};
+  // excluded from the steady state allocation count
+  std::chrono::seconds warmup{1};
+  RCTransmitterOptions transmitter;
+  // the same channel map as a live session, defaults if it does not exist
+  std::filesystem::path input_config;
+  // input recording replacing the synthetic sticks, the run lasts as long as the recording
+  std::string_view replay_path;
+  // replays on a virtual clock as fast as possible instead of in real time, channels go out
+  // every transmitter period of recording time and are byte identical between runs
+  bool replay_fast = false;
+  // a hidraw capture replacing the synthetic sticks, read by RCHidrawInput in real time until it ends
+  std::string_view hid_replay_path;
+};
+
+// the control path without SDL or mpv, selected with --headless [seconds].
+// synthetic sticks or a recording drive RCTransmitter into an RCBrain on a loopback transport, a simulated bridge
+// answers like the firmware does. prints a single json line and returns the process exit code.
+int runHeadless(const RCHeadlessOptions& options);
+
+// operator new calls of the whole process so far, nullopt unless built with RC_COUNT_ALLOCATIONS
+std::optional<uint64_t> allocationCount();
@@ -1,91 +1,41 @@
-#include "BasicTimer.hpp"
+#include "EventLoop.hpp"
+#include "LatencyHistogram.hpp"
+#include "RCBrain.hpp"
+#include "RCClockSync.hpp"
+#include "RCHidraw.hpp"
+#include "RCInput.hpp"
+#include "RCParameterTree.hpp"
+#include "RCParameters.hpp"
+#include "RCTransmitter.hpp"
+#include "SerialDevices.hpp"
+#include "bench.hpp"
+#include "headless.hpp"
+#include "rc-messages.hpp"
 #include "rc-protocol.hpp"
-#include "serialib.h"
 #include <SDL3/SDL.h>
 #include <algorithm>
 #include <array>
+#include <cctype>
+#include <charconv>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <mpv/client.h>
+#include <optional>
 #include <string>
+#include <sys/mman.h>
+#include <thread>
 #include <unordered_map>
 
 inline auto get_executable_path() {
   return std::filesystem::canonical("/proc/self/exe");
 }
 
-class RCBrain {
-private:
-  serialib _serial;
-
-  rc::GamepadEvent _gamepad_event;
-
-  std::array<rc::GamepadEvent, rc::CDC_PACKET_SIZE / sizeof(rc::GamepadEvent)> _buffer;
-  uint8_t _buffer_len = 0;
-
-  BasicTimer _serial_timer{std::chrono::milliseconds{4}};
-
-public:
-  bool open(std::string_view path = "", uint32_t baud = 115200) {
-    if (path.empty()) {
-      for (auto i = 0; i < 99; i++) {
-        auto device_name = std::format("/dev/ttyACM{}", i);
-        if (_serial.openDevice(device_name.data(), baud) == 1) {
-          return true;
-        }
-      }
-      return false;
-    } else {
-      return _serial.openDevice(path.data(), baud) == 1;
-    }
-  }
-
-  inline void write(const rc::GamepadEvent& gamepad_event) {
-    _buffer[_buffer_len++] = gamepad_event;
-
-    if (_serial_timer.hasTicked() || _buffer_len == _buffer.size()) {
-      _serial_timer.reset();
-
-      _serial.writeBytes(_buffer.data(), _buffer_len * sizeof(rc::GamepadEvent));
-      _buffer_len = 0;
-    }
-  }
-
-  inline void read(rc::RemoteEvent& remote_event) {
-    _serial.readBytes(&remote_event, sizeof(remote_event), 4);
-  }
-
-  inline bool available() {
-    return _serial.available();
-  }
-
-  void getParameter(uint8_t parameter) {
-    rc::GamepadEvent gamepad_event;
-    gamepad_event.type = rc::GamepadEvent::PAD_EVENT_GET_PARAMETER;
-    gamepad_event.get_parameter.parameter = parameter;
-    write(gamepad_event);
-  }
-
-  void setParameter(uint8_t parameter, uint8_t value) {
-    rc::GamepadEvent gamepad_event;
-    gamepad_event.type = rc::GamepadEvent::PAD_EVENT_SET_PARAMETER;
-    gamepad_event.set_parameter.parameter = parameter;
-    gamepad_event.set_parameter.value = value;
-    write(gamepad_event);
-  }
-
-  void requestAllConfigParameters() {
-    getParameter(rc::PARAM_PACKET_RATE);
-    getParameter(rc::PARAM_TLM_RATIO);
-    getParameter(rc::PARAM_MAX_POWER);
-    getParameter(rc::PARAM_LINK_MODE);
-  }
-};
-
 bool openFirstGamepad() {
   auto gamepad_count = 0;
   auto gamepads = SDL_GetGamepads(&gamepad_count);
@@ -183,12 +133,23 @@ public:
     return mpv_wait_event(_mpv, 0);
   }
 
+  int wakeupFD() {
+    return _mpv ? mpv_get_wakeup_pipe(_mpv) : -1;
+  }
+
+  void drainWakeups() {
+    char buffer[64];
+    while (read(wakeupFD(), buffer, sizeof(buffer)) > 0) {
+    }
+  }
+
   void setText(std::string_view key, RCOverlayText&& text) {
     _overlay[std::string{key}] = std::move(text);
     updateOverlay();
   }
 };
 
+// until the module's own entries are loaded
 static std::string_view elrs_packetrate_options[16] = {"50Hz", "100Hz", "150Hz", "250Hz", "333Hz", "500Hz", "D250Hz", "D500Hz", "F500Hz"};
 static std::string_view elrs_tlmratio_options[16] = {"Std", "Off", "1:128", "1:64", "1:32", "1:16", "1:8", "1:4", "1:2"};
 static std::string_view elrs_linkmode_options[16] = {"Normal", "MAVLink"};
@@ -210,6 +171,9 @@ struct RCConfig {
   bool visible = false;
   int8_t selection = 0;
 
+  // option names the module reported, the tables above until then
+  const RCParameterTree* tree = nullptr;
+
   // uint8_t elrs_channel = 0;
   // uint8_t vrx_channel = 0;
 
@@ -220,7 +184,11 @@ struct RCConfig {
 
   // uint8_t wifi = 0;
 
+  // tty path, "udp://host:port" or "unix:/path" of the bridge
   std::string serial_device;
+  uint32_t serial_baud = 115200;
+  // usb identity used to find the device when serial_device is empty
+  SerialDeviceMatch serial_usb;
   std::string video_device;
 
   void loadDevicePathsFromFile() {
@@ -240,11 +208,36 @@ struct RCConfig {
 
       OPT(serial_device);
       OPT(video_device);
+
+      if (key == "serial_baud") {
+        std::from_chars(value.data(), value.data() + value.size(), serial_baud);
+      }
+      if (key == "serial_usb") {
+        serial_usb = SerialDeviceMatch::parse(value);
+      }
     }
 
 #undef OPT
   }
 
+  std::string_view optionName(uint8_t parameter, std::string_view (&fallback)[16], uint8_t value) const {
+    if (auto entry = tree ? tree->find(parameter) : nullptr; entry && !entry->options.empty()) {
+      return value < entry->options.size() ? std::string_view{entry->options[value]} : std::string_view{};
+    }
+    return fallback[value];
+  }
+
+  // the next available option, unavailable ones have no name
+  uint8_t nextOption(uint8_t parameter, std::string_view (&fallback)[16], uint8_t value, int8_t direction) const {
+    for (auto i = 0; i < 16; i++) {
+      value = (value + direction) & 0xF;
+      if (!optionName(parameter, fallback, value).empty()) {
+        break;
+      }
+    }
+    return value;
+  }
+
   std::string to_string() {
 #define OPT(idx, name, value) \
   if (str.length())           \
@@ -254,10 +247,10 @@ struct RCConfig {
     std::string str;
     // OPT(elrs_channel, ELRS_CHANNEL);
     // OPT(vrx_channel, VRX_CHANNEL);
-    OPT(PACKET_RATE, "packet_rate", elrs_packetrate_options[packet_rate]);
-    OPT(TLM_RATIO, "tlm_ratio", elrs_tlmratio_options[tlm_ratio]);
-    OPT(LINK_MODE, "link_mode", elrs_linkmode_options[link_mode]);
-    OPT(TX_POWER, "tx_power", elrs_txpower_options[tx_power]);
+    OPT(PACKET_RATE, "packet_rate", optionName(rc::PARAM_PACKET_RATE, elrs_packetrate_options, packet_rate));
+    OPT(TLM_RATIO, "tlm_ratio", optionName(rc::PARAM_TLM_RATIO, elrs_tlmratio_options, tlm_ratio));
+    OPT(LINK_MODE, "link_mode", optionName(rc::PARAM_LINK_MODE, elrs_linkmode_options, link_mode));
+    OPT(TX_POWER, "tx_power", optionName(rc::PARAM_MAX_POWER, elrs_txpower_options, tx_power));
     // OPT(wifi, WIFI);
     return str;
 
@@ -285,7 +278,7 @@ struct RCConfig {
   static constexpr int8_t MOVE_LEFT = -1;
   static constexpr int8_t MOVE_RIGHT = +1;
 
-  void changeValueOfSelection(RCBrain& brain, int8_t direction) {
+  void changeValueOfSelection(RCParameters& parameters, int8_t direction) {
     switch (selection) {
     // case ELRS_CHANNEL:
     //   brain.setELRSChannel(elrs_channel += direction);
@@ -294,42 +287,263 @@ struct RCConfig {
     //   brain.setVRXChannel(vrx_channel += direction);
     //   break;
     case PACKET_RATE:
-      while (elrs_packetrate_options[packet_rate += direction] == "") {
-      }
-      brain.setParameter(rc::PARAM_PACKET_RATE, packet_rate);
+      packet_rate = nextOption(rc::PARAM_PACKET_RATE, elrs_packetrate_options, packet_rate, direction);
+      parameters.write(rc::PARAM_PACKET_RATE, packet_rate);
       break;
     case TLM_RATIO:
-      while (elrs_tlmratio_options[tlm_ratio += direction] == "") {
-      }
-      brain.setParameter(rc::PARAM_TLM_RATIO, tlm_ratio);
+      tlm_ratio = nextOption(rc::PARAM_TLM_RATIO, elrs_tlmratio_options, tlm_ratio, direction);
+      parameters.write(rc::PARAM_TLM_RATIO, tlm_ratio);
       break;
     case LINK_MODE:
-      while (elrs_linkmode_options[link_mode += direction] == "") {
-      }
-      brain.setParameter(rc::PARAM_LINK_MODE, link_mode);
+      link_mode = nextOption(rc::PARAM_LINK_MODE, elrs_linkmode_options, link_mode, direction);
+      parameters.write(rc::PARAM_LINK_MODE, link_mode);
       break;
     case TX_POWER:
-      while (elrs_txpower_options[tx_power += direction] == "") {
-      }
-      brain.setParameter(rc::PARAM_MAX_POWER, tx_power);
+      tx_power = nextOption(rc::PARAM_MAX_POWER, elrs_txpower_options, tx_power, direction);
+      parameters.write(rc::PARAM_MAX_POWER, tx_power);
       break;
       // case WIFI:
-      //   brain.setParameter(rc::PARAM_WIFI, wifi = !wifi);
+      //   parameters.write(rc::PARAM_WIFI, wifi = !wifi);
       //   break;
     }
   }
 };
 
-constexpr auto SDL_GAMEPAD_MIN_DIFF = 256;
-constexpr auto SDL_GAMEPAD_DEADZONE = 8192;
+// cpu time per wall second, wakeups and timing of the input tick.
+// enabled with --loop-stats, printed once per second.
+class RCLoopStats {
+private:
+  std::chrono::steady_clock::time_point _last_report = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds _last_cpu_time = processCPUTime();
+  uint64_t _last_wakeups = 0;
+
+  LatencyHistogram _tick_latency;
+
+  static std::chrono::nanoseconds processCPUTime() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+  }
+
+public:
+  bool enabled = false;
+
+  inline void recordTick(std::chrono::steady_clock::time_point deadline) {
+    _tick_latency.record(std::chrono::steady_clock::now() - deadline);
+  }
+
+  void report(uint64_t wakeups) {
+    auto now = std::chrono::steady_clock::now();
+    auto cpu_time = processCPUTime();
+
+    auto wall = std::chrono::duration<double>(now - _last_report).count();
+    auto cpu = std::chrono::duration<double>(cpu_time - _last_cpu_time).count();
+
+    printf("loop: cpu=%.2fms/s wakeups=%.0f/s tick_latency[p50=%uus p99=%uus max=%uus]\n",
+      cpu * 1000.0 / wall, (wakeups - _last_wakeups) / wall,
+      _tick_latency.percentile(50), _tick_latency.percentile(99), _tick_latency.max());
+
+    _last_report = now;
+    _last_cpu_time = cpu_time;
+    _last_wakeups = wakeups;
+    _tick_latency.reset();
+  }
+};
+
+// round trip of the PAD_EVENT_PING the transmitter sends along with the channels. the firmware holds the pong until
+// the crsf channels frame is written, so once the host and firmware clocks are synced it also gives the one way
+// latency per stage: input (age of the newest stick sample when it is sent), usb (host write to firmware decode),
+// firmware (decode to the crsf channels frame on the wire) and total (stick sample to the wire)
+class RCPingStats {
+private:
+  static constexpr auto WINDOW = std::chrono::seconds{10};
+
+  RCClockSync _clock;
+
+  LatencyHistogram _rtt;
+  LatencyHistogram _input;
+  LatencyHistogram _usb;
+  LatencyHistogram _firmware;
+  LatencyHistogram _total;
+  std::chrono::steady_clock::time_point _window_start = std::chrono::steady_clock::now();
+  uint32_t _next_sequence = 0;
+  // kept across windows, the first pong ever has nothing to compare its sequence with
+  bool _has_sequence = false;
+  uint32_t _lost = 0;
+
+public:
+  void record(const rc::msg::Pong::payload_type& pong) {
+    int64_t t0 = pong.sent_at_ns;
+    int64_t t3 = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto t1 = _clock.unwrap(pong.received_at_us);
+    auto crsf_written = _clock.unwrap(pong.crsf_written_at_us);
+    auto t2 = _clock.unwrap(pong.replied_at_us);
+
+    // the firmware holds the pong until the crsf frame went out, that time is not part of the path
+    _rtt.record(std::chrono::nanoseconds{(t3 - t0) - (t2 - t1) * 1000});
+    _clock.addExchange(t0, t1, t2, t3);
+
+    if (_has_sequence && pong.sequence > _next_sequence) {
+      _lost += pong.sequence - _next_sequence;
+    }
+    _next_sequence = pong.sequence + 1;
+    _has_sequence = true;
+
+    if (!_clock.synced()) {
+      return;
+    }
+
+    auto usb = std::chrono::nanoseconds{std::max<int64_t>(_clock.toHostNs(t1) - t0, 0)};
+    auto firmware = std::chrono::microseconds{crsf_written - t1};
+    _usb.record(usb);
+    _firmware.record(firmware);
+
+    // a tick without any stick sample yet has no input stage, and so no total either
+    if (pong.sample_age_us == UINT32_MAX) {
+      return;
+    }
+    auto input = std::chrono::microseconds{pong.sample_age_us};
+    _input.record(input);
+    _total.record(input + usb + firmware);
+  }
+
+  void show(RCVideoPlayer& video) {
+    if (!_rtt.count()) {
+      video.setText("rtt", {"rtt: -", "w-tw-16", "16"});
+      return;
+    }
+    if (!_total.count()) {
+      video.setText("rtt", {std::format("rtt: {}/{}us", _rtt.percentile(50), _rtt.percentile(99)), "w-tw-16", "16"});
+      return;
+    }
+    video.setText("rtt", {std::format("age: {}us wire: {}us rtt: {}us", _input.percentile(50), _total.percentile(50), _rtt.percentile(50)), "w-tw-16", "16"});
+  }
+
+  // logs and starts a new window every WINDOW
+  void reportIfDue() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - _window_start < WINDOW) {
+      return;
+    }
+
+    printf("rtt: pongs=%llu lost=%u rtt[p50=%uus p99=%uus max=%uus]\n",
+      (unsigned long long)_rtt.count(), _lost, _rtt.percentile(50), _rtt.percentile(99), _rtt.max());
+
+    if (_clock.synced()) {
+      auto stage = [](const char* name, const LatencyHistogram& histogram) {
+        printf(" %s[p50=%uus p99=%uus]", name, histogram.percentile(50), histogram.percentile(99));
+      };
+      printf("latency:");
+      stage("input", _input);
+      stage("usb", _usb);
+      stage("firmware", _firmware);
+      stage("total", _total);
+      printf(" clock[offset=%lldus drift=%.1fppm delay=%lldus]\n",
+        (long long)std::chrono::duration_cast<std::chrono::microseconds>(_clock.offset()).count(), _clock.driftPPM(),
+        (long long)std::chrono::duration_cast<std::chrono::microseconds>(_clock.delay()).count());
+    }
+
+    _rtt.reset();
+    _input.reset();
+    _usb.reset();
+    _firmware.reset();
+    _total.reset();
+    _lost = 0;
+    _window_start = now;
+  }
+};
 
 int main(int argc, char** argv) {
+  RCLoopStats stats;
+  RCPingStats ping_stats;
+  RCTransmitterOptions transmitter_options;
+  bool lock_memory = false;
+  bool print_parameter_tree = false;
+  std::optional<RCHeadlessOptions> headless;
+  std::string_view record_path;
+  std::string_view replay_path;
+  bool replay_fast = false;
+  bool use_hidraw = false;
+  std::string_view hidraw_device;
+  std::string_view hid_capture_path;
+  std::string_view hid_replay_path;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    if (arg == "--bench" && i + 1 < argc) {
+      return runBenchmark(argv[++i]);
+    } else if (arg == "--loop-stats") {
+      stats.enabled = true;
+    } else if (arg == "--tx-fifo" && i + 1 < argc) {
+      transmitter_options.fifo_priority = std::atoi(argv[++i]);
+    } else if (arg == "--tx-cpu" && i + 1 < argc) {
+      transmitter_options.cpu = std::atoi(argv[++i]);
+    } else if (arg == "--ping-ms" && i + 1 < argc) {
+      transmitter_options.ping_interval = std::chrono::milliseconds{std::atoi(argv[++i])};
+    } else if (arg == "--mlockall") {
+      lock_memory = true;
+    } else if (arg == "--parameter-tree") {
+      print_parameter_tree = true;
+    } else if (arg == "--record" && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (arg == "--replay-fast") {
+      replay_fast = true;
+    } else if (arg == "--hidraw") {
+      use_hidraw = true;
+      if (i + 1 < argc && std::string_view{argv[i + 1]}.starts_with("/dev/")) {
+        hidraw_device = argv[++i];
+      }
+    } else if (arg == "--hid-capture" && i + 1 < argc) {
+      hid_capture_path = argv[++i];
+    } else if (arg == "--hid-replay" && i + 1 < argc) {
+      hid_replay_path = argv[++i];
+    } else if (arg == "--headless") {
+      headless.emplace();
+      if (i + 1 < argc && std::isdigit(argv[i + 1][0])) {
+        headless->duration = std::chrono::seconds{std::atoi(argv[++i])};
+      }
+    }
+  }
+
+  if (lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    printf("mlockall failed: %s\n", strerror(errno));
+  }
+
+  // which axes and buttons drive which channels, and the deadzone, expo and rates of the axes
+  auto input_config = get_executable_path().parent_path() / "input.cfg";
+
+  if (headless) {
+    headless->input_config = input_config;
+    headless->transmitter = transmitter_options;
+    headless->replay_path = replay_path;
+    headless->replay_fast = replay_fast;
+    headless->hid_replay_path = hid_replay_path;
+    return runHeadless(*headless);
+  }
+
   RCConfig config;
   config.loadDevicePathsFromFile();
 
+  auto transport = RCTransport::create(config.serial_device, config.serial_baud, config.serial_usb);
+  if (!transport) {
+    printf("malformed bridge uri in serial_device: '%s'\n", config.serial_device.data());
+    return 1;
+  }
+
   RCBrain brain;
-  if (brain.open(config.serial_device)) {
-    printf("opened serial device at %s\n", config.serial_device.data());
+  if (brain.open(std::move(transport))) {
+    printf("opened bridge at %s\n", config.serial_device.data());
+  }
+
+  RCParameters parameters{brain};
+
+  RCParameterTree parameter_tree{brain};
+  config.tree = &parameter_tree;
+  if (print_parameter_tree) {
+    parameter_tree.on_loaded = [&]() {
+      parameter_tree.print();
+    };
   }
 
   RCVideoPlayer video;
@@ -345,29 +559,170 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  brain.requestAllConfigParameters();
+  // reported and cached values alike, the cache fills the menu before the module answered
+  parameters.on_value = [&](uint8_t parameter, uint8_t value) {
+    switch (parameter) {
+    case rc::PARAM_PACKET_RATE:
+      printf("PARAM_PACKET_RATE = %d\n", value);
+      config.packet_rate = value;
+      config.showIfVisible(video);
+      break;
+    case rc::PARAM_TLM_RATIO:
+      printf("PARAM_TLM_RATIO = %d\n", value);
+      config.tlm_ratio = value;
+      config.showIfVisible(video);
+      break;
+    case rc::PARAM_LINK_MODE:
+      printf("PARAM_LINK_MODE = %d\n", value);
+      config.link_mode = value;
+      config.showIfVisible(video);
+      break;
+    case rc::PARAM_MAX_POWER:
+      printf("PARAM_POWER = %d\n", value);
+      config.tx_power = value;
+      config.showIfVisible(video);
+      break;
+    case rc::PARAM_WIFI:
+      printf("PARAM_WIFI = %d\n", value);
+      break;
+    }
+  };
+
+  // option names of the module replace the built in ones as their entries arrive
+  parameter_tree.on_entry = [&](const RCParameterEntry&) {
+    config.showIfVisible(video);
+  };
 
-  rc::GamepadEvent gamepad_event;
   rc::RemoteEvent remote_event;
 
   SDL_Event event;
 
-  int16_t axis_positions[rc::SDL_GAMEPAD_AXIS_COUNT] = {0};
+  RCTransmitter transmitter{brain};
+
+  // compiled into lookup tables once here, the input path only looks values up
+  RCChannelMap channel_map;
+  channel_map.loadFromFile(input_config);
+
+  RCInput input{brain, transmitter, channel_map};
+  RCInputRecorder recorder;
+  if (!record_path.empty() && !recorder.open(record_path)) {
+    printf("failed to open %.*s for recording\n", (int)record_path.size(), record_path.data());
+  }
+  RCInputReplay replay;
+  if (!replay_path.empty() && !replay.load(replay_path)) {
+    printf("failed to load the input recording %.*s\n", (int)replay_path.size(), replay_path.data());
+  }
+
+  auto applyInput = [&](const RCInputEvent& input_event, std::chrono::steady_clock::time_point sampled_at) {
+    recorder.record(input_event);
+    input.apply(input_event, sampled_at);
+  };
+
+  // live input from SDL or hidraw, the start button and the menu stay on the host
+  auto handleInput = [&](const RCInputEvent& input_event, std::chrono::steady_clock::time_point sampled_at) {
+    switch (input_event.type) {
+    case SDL_EVENT_GAMEPAD_BUTTON_DOWN:
+      printf("SDL_EVENT_GAMEPAD_BUTTON_DOWN: %d\n", input_event.index);
+      if (input_event.index == SDL_GAMEPAD_BUTTON_START) {
+        config.visible = !config.visible;
+        if (config.visible) {
+          if (config.packet_rate == 0xF) {
+            parameters.readAll();
+          }
+          parameter_tree.openFolder();
+          parameter_tree.load(RCParameters::CONFIG_PARAMETERS);
+          config.show(video);
+        } else {
+          config.hide(video);
+          parameters.readAll();
+        }
+      } else if (config.visible) {
+        switch (input_event.index) {
+        case SDL_GAMEPAD_BUTTON_DPAD_UP:
+          config.selection = std::max<int8_t>(config.selection - 1, RCConfig::INVALID + 1);
+          config.show(video);
+          break;
+        case SDL_GAMEPAD_BUTTON_DPAD_DOWN:
+          config.selection = std::min<int8_t>(config.selection + 1, RCConfig::COUNT - 1);
+          config.show(video);
+          break;
+        case SDL_GAMEPAD_BUTTON_DPAD_LEFT:
+          config.changeValueOfSelection(parameters, RCConfig::MOVE_LEFT);
+          config.show(video);
+          break;
+        case SDL_GAMEPAD_BUTTON_DPAD_RIGHT:
+          config.changeValueOfSelection(parameters, RCConfig::MOVE_RIGHT);
+          config.show(video);
+          break;
+        }
+      } else {
+        applyInput(input_event, sampled_at);
+      }
+      break;
+
+    case SDL_EVENT_GAMEPAD_BUTTON_UP:
+      printf("SDL_EVENT_GAMEPAD_BUTTON_UP: %d\n", input_event.index);
+      applyInput(input_event, sampled_at);
+      break;
 
-  BasicTimer channel_timer{std::chrono::milliseconds{4}};
+    default:
+      applyInput(input_event, sampled_at);
+      break;
+    }
+  };
 
-  bool running = true;
-  while (running) {
+  // the controller's reports straight from hidraw instead of the SDL event queue, SDL keeps quit and hotplug
+  RCHidrawInput hidraw;
+  auto hidraw_enabled = false;
+  if (!hid_replay_path.empty()) {
+    hidraw_enabled = hidraw.openReplay(hid_replay_path);
+    if (!hidraw_enabled) {
+      printf("failed to load the hid capture %.*s\n", (int)hid_replay_path.size(), hid_replay_path.data());
+    }
+  } else if (use_hidraw) {
+    hidraw_enabled = hidraw.open(hidraw_device);
+  }
+  if (hidraw_enabled && !hid_capture_path.empty() && !hidraw.capture(hid_capture_path)) {
+    printf("failed to open %.*s for the hid capture\n", (int)hid_capture_path.size(), hid_capture_path.data());
+  }
+  // the transmit thread reads the sticks at its deadline, SDL's state only changes when the input tick pumps it
+  if (hidraw_enabled) {
+    transmitter.setSampler(hidraw, channel_map);
+  }
+  RCGamepadState hid_state;
+
+  EventLoop loop;
+
+  // joystick devices are only read while SDL pumps events, which happens on every input tick.
+  // events pushed from other threads (quit, hotplug) wake the loop through this eventfd.
+  EventFD sdl_wakeup;
+  static auto main_thread_id = std::this_thread::get_id();
+  SDL_AddEventWatch(
+    [](void* userdata, SDL_Event*) {
+      if (std::this_thread::get_id() != main_thread_id) {
+        ((EventFD*)userdata)->signal();
+      }
+      return true;
+    },
+    &sdl_wakeup);
+
+  auto pollSDLEvents = [&]() {
     while (SDL_PollEvent(&event)) {
       switch (event.type) {
       case SDL_EVENT_QUIT:
-        running = false;
+        loop.stop();
         break;
 
       case SDL_EVENT_GAMEPAD_ADDED:
         printf("SDL_EVENT_GAMEPAD_ADDED\n");
         openFirstGamepad();
-        brain.requestAllConfigParameters();
+        // the controller is back after it was gone, read it from hidraw again
+        if (use_hidraw && hid_replay_path.empty() && !hidraw_enabled && hidraw.open(hidraw_device)) {
+          hidraw_enabled = true;
+          transmitter.setSampler(hidraw, channel_map);
+          hidraw.start();
+        }
+        parameters.readAll();
         break;
 
       case SDL_EVENT_GAMEPAD_REMOVED:
@@ -375,66 +730,17 @@ int main(int argc, char** argv) {
         break;
 
       case SDL_EVENT_GAMEPAD_BUTTON_DOWN:
-        printf("SDL_EVENT_GAMEPAD_BUTTON_DOWN: %d\n", event.gbutton.button);
-        if (event.gbutton.button == SDL_GAMEPAD_BUTTON_START) {
-          config.visible = !config.visible;
-          if (config.visible) {
-            if (config.packet_rate == 0xF) {
-              brain.requestAllConfigParameters();
-            }
-            config.show(video);
-          } else {
-            config.hide(video);
-            brain.requestAllConfigParameters();
-          }
-        } else {
-          if (config.visible) {
-            switch (event.gbutton.button) {
-            case SDL_GAMEPAD_BUTTON_DPAD_UP:
-              config.selection = std::max<int8_t>(config.selection - 1, RCConfig::INVALID + 1);
-              config.show(video);
-              break;
-            case SDL_GAMEPAD_BUTTON_DPAD_DOWN:
-              config.selection = std::min<int8_t>(config.selection + 1, RCConfig::COUNT - 1);
-              config.show(video);
-              break;
-            case SDL_GAMEPAD_BUTTON_DPAD_LEFT:
-              config.changeValueOfSelection(brain, RCConfig::MOVE_LEFT);
-              config.show(video);
-              break;
-            case SDL_GAMEPAD_BUTTON_DPAD_RIGHT:
-              config.changeValueOfSelection(brain, RCConfig::MOVE_RIGHT);
-              config.show(video);
-              break;
-            }
-          } else {
-            gamepad_event.type = SDL_EVENT_GAMEPAD_BUTTON_DOWN;
-            gamepad_event.button_down.button = event.gbutton.button;
-            brain.write(gamepad_event);
-          }
-        }
-        break;
-
       case SDL_EVENT_GAMEPAD_BUTTON_UP:
-        printf("SDL_EVENT_GAMEPAD_BUTTON_UP: %d\n", event.gbutton.button);
-        if (!config.visible) {
-          gamepad_event.type = SDL_EVENT_GAMEPAD_BUTTON_UP;
-          gamepad_event.button_down.button = event.gbutton.button;
-          brain.write(gamepad_event);
+        if (!hidraw_enabled) {
+          handleInput({event.gbutton.timestamp, (uint16_t)event.type, event.gbutton.button, 0}, std::chrono::steady_clock::now());
         }
         break;
 
       case SDL_EVENT_GAMEPAD_AXIS_MOTION:
-        if (std::abs(event.gaxis.value) < SDL_GAMEPAD_DEADZONE) {
-          event.gaxis.value = 0;
-        } else {
-          if (event.gaxis.value > 0) {
-            event.gaxis.value -= SDL_GAMEPAD_DEADZONE;
-          } else {
-            event.gaxis.value += SDL_GAMEPAD_DEADZONE;
-          }
+        if (!hidraw_enabled) {
+          handleInput({event.gaxis.timestamp, SDL_EVENT_GAMEPAD_AXIS_MOTION, event.gaxis.axis, event.gaxis.value},
+            std::chrono::steady_clock::now() - std::chrono::nanoseconds{SDL_GetTicksNS() - event.gaxis.timestamp});
         }
-        axis_positions[event.gaxis.axis] = event.gaxis.value;
         // if (std::abs(std::abs(event.gaxis.value) - std::abs(axis_positions[event.gaxis.axis])) > SDL_GAMEPAD_MIN_DIFF) {
         //   axis_positions[event.gaxis.axis] = event.gaxis.value;
         //   // printf("SDL_EVENT_GAMEPAD_AXIS_MOTION: %d, %d\n", event.gaxis.axis, event.gaxis.value);
@@ -447,21 +753,11 @@ int main(int argc, char** argv) {
         break;
       }
     }
+  };
 
-    if (channel_timer.resetIfTicked()) {
-      for (int i = 0; i < 4; i++) {
-        gamepad_event.type = SDL_EVENT_GAMEPAD_AXIS_MOTION;
-        gamepad_event.axis_motion.axis = i;
-        gamepad_event.axis_motion.value = axis_positions[i];
-        brain.write(gamepad_event);
-      }
-    }
-
-    if (brain.available()) {
-      brain.read(remote_event);
-      switch (remote_event.type) {
-      case rc::RemoteEvent::RC_EVENT_REPORT_LINK_STATS: {
-        auto& l = remote_event.report_link_stats;
+  auto handleRemoteEvent = [&]() {
+    rc::RemoteMessages::dispatch(remote_event, rc::Handlers{
+      [&](rc::msg::ReportLinkStats, const auto& l) {
         video.setText("link_stats", {
           // std::format("rssi[up]: {}\n lqi[up]: {}\n snr[up]: {}\nrate[up]: {}\npowr[up]: {}\nrssi[dn]: {}\n lqi[dn]: {}\n snr[dn]: {}",
           //   (l.up_rssi_ant1 + l.up_rssi_ant2) / 2, l.up_link_quality, l.up_snr, l.rf_profile, l.up_rf_power, l.down_rssi, l.down_link_quality, l.down_snr
@@ -472,68 +768,212 @@ int main(int argc, char** argv) {
           "w-th-16", "h-th-16"
         });
         // printf("stat: rssi1=-%ddBm rssi2=-%ddBm lqi=%d%% snr=%ddB ant=%d rate=%dhz power=%dmW d_rssi=-%ddBm d_lqi=%d%% d_snr=%ddB\n", l.up_rssi_ant1, l.up_rssi_ant2, l.up_link_quality, l.up_snr, l.active_antenna, l.rf_profile, l.up_rf_power, l.down_rssi, l.down_link_quality, l.down_snr);
-      } break;
+      },
 
-      case rc::RemoteEvent::RC_EVENT_REPORT_TELEMETRY: {
-        auto& t = remote_event.report_telemetry;
+      [&](rc::msg::ReportTelemetry, const auto& t) {
         // video.setText("attitude", {
         //   std::format(""),
         //   "w-240", "h-th-16"
         // });
-      } break;
+      },
 
-      case rc::RemoteEvent::RC_EVENT_REPORT_ARMED:
-        printf("RC_EVENT_REPORT_ARMED: %d\n", remote_event.report_armed.armed);
-        break;
+      [&](rc::msg::ReportArmed, const auto& report_armed) {
+        printf("RC_EVENT_REPORT_ARMED: %d\n", report_armed.armed);
+        parameters.setArmed(report_armed.armed);
+      },
 
-      case rc::RemoteEvent::RC_EVENT_REPORT_PARAMETER:
-        switch (remote_event.report_parameter.parameter) {
-        case rc::PARAM_PACKET_RATE:
-          printf("PARAM_PACKET_RATE = %d\n", remote_event.report_parameter.value);
-          config.packet_rate = remote_event.report_parameter.value;
-          config.showIfVisible(video);
-          break;
-        case rc::PARAM_TLM_RATIO:
-          printf("PARAM_TLM_RATIO = %d\n", remote_event.report_parameter.value);
-          config.tlm_ratio = remote_event.report_parameter.value;
-          config.showIfVisible(video);
-          break;
-        case rc::PARAM_LINK_MODE:
-          printf("PARAM_LINK_MODE = %d\n", remote_event.report_parameter.value);
-          config.link_mode = remote_event.report_parameter.value;
-          config.showIfVisible(video);
-          break;
-        case rc::PARAM_MAX_POWER:
-          printf("PARAM_POWER = %d\n", remote_event.report_parameter.value);
-          config.tx_power = remote_event.report_parameter.value;
-          config.showIfVisible(video);
-          break;
-        case rc::PARAM_WIFI:
-          printf("PARAM_WIFI = %d\n", remote_event.report_parameter.value);
-          break;
+      [&](rc::msg::ReportParameter, const auto& report_parameter) {
+        parameters.onReport(report_parameter.parameter, report_parameter.value);
+      },
+
+      [&](rc::msg::ReportDeviceInfo, const auto& device_info) {
+        parameter_tree.onDeviceInfo(device_info.parameters_total);
+        if (print_parameter_tree) {
+          parameter_tree.loadAll();
         }
-        break;
+        parameters.onDeviceInfo({
+          device_info.serial_number, device_info.hardware_id, device_info.firmware_id, device_info.parameter_version,
+          std::string{device_info.name, strnlen(device_info.name, sizeof(device_info.name))},
+        });
+      },
+
+      [&](rc::msg::ReportParameterEntry, const auto& slice) {
+        parameter_tree.onEntrySlice(slice);
+      },
 
-      // case rc::RemoteEvent::RC_EVENT_REPORT_PARAMETER:
+      // [&](rc::msg::ReportParameter, const auto& report_parameter) {
       //   printf("RC_EVENT_REPORT_PARAMETER: %d\n", remote_event.report_vrx_channel.channel);
-      //   break;
+      // },
 
-      case rc::RemoteEvent::RC_EVENT_REPORT_VRX_CHANNEL:
-        printf("RC_EVENT_NOTIFY_VRX_CHANNEL: %d\n", remote_event.report_vrx_channel.channel);
-        break;
+      [&](rc::msg::ReportVRXChannel, const auto& report_vrx_channel) {
+        printf("RC_EVENT_NOTIFY_VRX_CHANNEL: %d\n", report_vrx_channel.channel);
+      },
 
-      case rc::RemoteEvent::RC_EVENT_REPORT_VRX_RSSI:
-        printf("RC_EVENT_NOTIFY_VRX_RSSI: %d%%\n", remote_event.report_vrx_rssi.percent);
-        break;
+      [&](rc::msg::ReportVRXRSSI, const auto& report_vrx_rssi) {
+        printf("RC_EVENT_NOTIFY_VRX_RSSI: %d%%\n", report_vrx_rssi.percent);
+      },
+
+      [&](rc::msg::Pong, const auto& pong) {
+        ping_stats.record(pong);
+      },
+    });
+  };
+
+  auto replay_started = std::chrono::steady_clock::now();
+  TimerFD input_timer;
+  input_timer.start(std::chrono::milliseconds{4});
+  loop.add(input_timer.fd(), EPOLLIN, [&](uint32_t) {
+    if (!input_timer.consume()) {
+      return;
+    }
+
+    if (stats.enabled) {
+      stats.recordTick(input_timer.lastExpiry());
+    }
+
+    pollSDLEvents();
+
+    if (RCGamepadState state; hidraw.take(state)) {
+      state.diff(hid_state, [&](const RCInputEvent& input_event) {
+        handleInput(input_event, std::chrono::steady_clock::time_point{std::chrono::nanoseconds{state.read_at_ns}});
+      });
+      hid_state = state;
+    }
+
+    // polled on the same tick as SDL, so replayed events reach the transmitter with the same timing live ones do
+    if (!replay.done()) {
+      auto now = std::chrono::steady_clock::now();
+      replay.playUntil(now - replay_started, [&](const RCInputEvent& input_event, std::chrono::nanoseconds) {
+        input.apply(input_event, now);
+      });
+    }
+
+    input.evaluate();
+  });
+
+  loop.add(sdl_wakeup.fd(), EPOLLIN, [&](uint32_t) {
+    sdl_wakeup.consume();
+    pollSDLEvents();
+    input.evaluate();
+  });
+
+  // the sticks center and the buttons release instead of holding the last report, SDL input takes over
+  // until SDL_EVENT_GAMEPAD_ADDED reopens the device
+  loop.add(hidraw.goneFD(), EPOLLIN, [&](uint32_t) {
+    if (!hidraw.consumeGone()) {
+      return;
+    }
+    hidraw.stop();
+    hidraw_enabled = false;
+    transmitter.clearSampler();
+    printf("hidraw: falling back to SDL input\n");
+
+    // a report still waiting from before the device went away is dropped, not applied
+    RCGamepadState stale;
+    hidraw.take(stale);
+    RCGamepadState released;
+    released.read_at_ns = std::chrono::steady_clock::now().time_since_epoch().count();
+    released.diff(hid_state, [&](const RCInputEvent& input_event) {
+      handleInput(input_event, std::chrono::steady_clock::time_point{std::chrono::nanoseconds{released.read_at_ns}});
+    });
+    hid_state = {};
+    input.evaluate();
+  });
+
+  auto watchSerial = [&]() {
+    loop.add(brain.fd(), EPOLLIN, [&](uint32_t events) {
+      if (events & (EPOLLHUP | EPOLLERR)) {
+        printf("serial device disconnected\n");
+        loop.remove(brain.fd());
+        brain.disconnect();
+        return;
       }
+
+      brain.read(remote_event, handleRemoteEvent);
+    });
+  };
+
+  if (brain.connected()) {
+    watchSerial();
+  }
+
+  auto reconnectBridge = [&]() {
+    if (brain.connected()) {
+      return;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    if (brain.reconnect()) {
+      printf("bridge reconnected in %lldus\n", (long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count());
+      watchSerial();
+      parameters.reset();
+      parameter_tree.reset();
     }
+  };
 
-    auto mpv_event = video.pollEvent();
-    if (mpv_event) {
+  // the esp32 re-enumerates on reset, reopen it as soon as udev has set up the new node
+  SerialHotplug hotplug;
+  loop.add(hotplug.fd(), EPOLLIN, [&](uint32_t) {
+    if (hotplug.consume()) {
+      reconnectBridge();
+    }
+  });
+
+  // socket bridges have no hotplug event, retry them periodically
+  TimerFD reconnect_timer;
+  reconnect_timer.start(std::chrono::milliseconds{500});
+  loop.add(reconnect_timer.fd(), EPOLLIN, [&](uint32_t) {
+    reconnect_timer.consume();
+    reconnectBridge();
+  });
+
+  loop.add(video.wakeupFD(), EPOLLIN, [&](uint32_t) {
+    video.drainWakeups();
+    for (auto mpv_event = video.pollEvent(); mpv_event->event_id != MPV_EVENT_NONE; mpv_event = video.pollEvent()) {
       if (mpv_event->event_id == MPV_EVENT_SHUTDOWN) {
-        running = false;
-        continue;
+        loop.stop();
+        break;
       }
     }
+  });
+
+  TimerFD rtt_timer;
+  rtt_timer.start(std::chrono::seconds{1});
+  loop.add(rtt_timer.fd(), EPOLLIN, [&](uint32_t) {
+    rtt_timer.consume();
+    ping_stats.show(video);
+    ping_stats.reportIfDue();
+  });
+
+  // parameter requests time out and retry from here, never from the input path
+  TimerFD parameters_timer;
+  parameters_timer.start(std::chrono::milliseconds{100});
+  loop.add(parameters_timer.fd(), EPOLLIN, [&](uint32_t) {
+    parameters_timer.consume();
+    parameters.tick();
+    parameter_tree.tick();
+  });
+
+  TimerFD stats_timer;
+  if (stats.enabled) {
+    stats_timer.start(std::chrono::seconds{1});
+    loop.add(stats_timer.fd(), EPOLLIN, [&](uint32_t) {
+      stats_timer.consume();
+      stats.report(loop.wakeups());
+      transmitter.printReport();
+      if (hidraw_enabled) {
+        hidraw.printReport();
+      }
+      parameters.printReport();
+      parameter_tree.printReport();
+    });
   }
+
+  transmitter.start(transmitter_options);
+  hidraw.start();
+
+  loop.run();
+
+  hidraw.stop();
+  transmitter.stop();
 }
@@ -0,0 +1 @@
+../../esp32-mini/src/rc-framing.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../esp32-mini/src/rc-messages.hpp
\ No newline at end of file
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "rc-protocol.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// rc stream over udp for a network attached bridge.
+// every datagram carries the newest flush plus copies of the previous ones, so a lost datagram is
+// recovered from the next one instead of being retransmitted. the receiver orders them by sequence
+// and plays them out through a small jitter buffer.
+//
+//   SEQUENCE(u32) | SENT_AT_US(u32) | COUNT | { AGE | LEN | PAYLOAD[LEN] } x COUNT
+//
+// payloads are framed rc streams (see rc-framing.hpp), the link does not look into them.
+// times are in microseconds of the sender's / receiver's own clock and may wrap.
+namespace rc {
+constexpr size_t UDP_LINK_MAX_PAYLOAD_SIZE = CDC_PACKET_SIZE;
+constexpr uint8_t UDP_LINK_MAX_REDUNDANCY = 3;
+
+struct __attribute__((packed)) UDPLinkHeader {
+  uint32_t sequence;
+  uint32_t sent_at_us;
+  uint8_t count;
+};
+
+struct __attribute__((packed)) UDPLinkChunk {
+  // how many datagrams ago this payload was sent first, 0 for the newest
+  uint8_t age;
+  uint8_t len;
+};
+
+constexpr size_t UDP_LINK_MAX_DATAGRAM_SIZE = sizeof(UDPLinkHeader) + UDP_LINK_MAX_REDUNDANCY * (sizeof(UDPLinkChunk) + UDP_LINK_MAX_PAYLOAD_SIZE);
+
+class UDPLinkSender {
+private:
+  uint32_t _sequence = 0;
+  uint8_t _redundancy;
+
+  // previous payloads, newest first
+  std::array<std::array<uint8_t, UDP_LINK_MAX_PAYLOAD_SIZE>, UDP_LINK_MAX_REDUNDANCY - 1> _history;
+  std::array<uint8_t, UDP_LINK_MAX_REDUNDANCY - 1> _history_len = {};
+
+public:
+  // redundancy is the number of payloads per datagram, 1 sends every payload once
+  explicit UDPLinkSender(uint8_t redundancy = 2) : _redundancy{redundancy < 1 ? (uint8_t)1 : redundancy > UDP_LINK_MAX_REDUNDANCY ? UDP_LINK_MAX_REDUNDANCY : redundancy} {
+    // nothing
+  }
+
+  // writes a datagram to out (at least UDP_LINK_MAX_DATAGRAM_SIZE bytes) and returns its size
+  size_t encode(const uint8_t* payload, uint8_t len, uint32_t now_us, uint8_t* out) {
+    if (len > UDP_LINK_MAX_PAYLOAD_SIZE) {
+      return 0;
+    }
+
+    UDPLinkHeader header{_sequence++, now_us, 0};
+    size_t size = sizeof(header);
+
+    auto appendChunk = [&](uint8_t age, const uint8_t* data, uint8_t data_len) {
+      UDPLinkChunk chunk{age, data_len};
+      memcpy(&out[size], &chunk, sizeof(chunk));
+      memcpy(&out[size + sizeof(chunk)], data, data_len);
+      size += sizeof(chunk) + data_len;
+      header.count++;
+    };
+
+    appendChunk(0, payload, len);
+    for (uint8_t age = 1; age < _redundancy && age <= header.sequence; age++) {
+      appendChunk(age, _history[age - 1].data(), _history_len[age - 1]);
+    }
+    memcpy(out, &header, sizeof(header));
+
+    for (size_t i = _history.size() - 1; i > 0; i--) {
+      _history[i] = _history[i - 1];
+      _history_len[i] = _history_len[i - 1];
+    }
+    memcpy(_history[0].data(), payload, len);
+    _history_len[0] = len;
+
+    return size;
+  }
+};
+
+// reorders payloads by sequence and holds each one until its playout time, sent time plus the
+// smallest transit seen plus a delay that follows the measured jitter (RFC 3550 estimator).
+// a payload that arrives after a newer one was played is dropped, the streams carry latest state
+// and the redundant copies make sure an urgent event is rarely behind a gap for longer than one datagram.
+struct UDPLinkReceiverOptions {
+  uint32_t min_delay_us = 0;
+  uint32_t max_delay_us = 20'000;
+  // target delay in multiples of the jitter estimate
+  uint8_t jitter_factor = 3;
+};
+
+class UDPLinkReceiver {
+public:
+  struct Stats {
+    uint32_t datagrams = 0;
+    uint32_t played = 0;
+    // payloads only received as a redundant copy
+    uint32_t recovered = 0;
+    uint32_t duplicates = 0;
+    uint32_t late = 0;
+    uint32_t lost = 0;
+  };
+
+private:
+  static constexpr size_t SLOT_COUNT = 16;
+  static constexpr uint32_t SEQUENCE_RESTART_DISTANCE = 1024;
+
+  struct Slot {
+    bool used = false;
+    uint32_t sequence;
+    uint32_t playout_us;
+    uint8_t len;
+    std::array<uint8_t, UDP_LINK_MAX_PAYLOAD_SIZE> payload;
+  };
+
+  UDPLinkReceiverOptions _options;
+  Stats _stats;
+
+  std::array<Slot, SLOT_COUNT> _slots;
+  bool _started = false;
+  uint32_t _next = 0;
+
+  bool _has_transit = false;
+  // smallest one way transit (receiver clock minus sender clock), creeps up to follow clock drift
+  int32_t _base_transit = 0;
+  int32_t _last_transit = 0;
+  // mean deviation of the transit in 1/16 us
+  uint32_t _jitter_16 = 0;
+
+  static inline bool before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+  }
+
+  void updateTransit(uint32_t sent_at_us, uint32_t now_us) {
+    int32_t transit = now_us - sent_at_us;
+    if (!_has_transit) {
+      _has_transit = true;
+      _base_transit = _last_transit = transit;
+      return;
+    }
+
+    auto deviation = transit - _last_transit;
+    _last_transit = transit;
+    uint32_t d = deviation < 0 ? -deviation : deviation;
+    _jitter_16 += d - ((_jitter_16 + 8) >> 4);
+
+    if (transit < _base_transit) {
+      _base_transit = transit;
+    } else {
+      _base_transit += (transit - _base_transit) >> 10;
+    }
+  }
+
+  // gives up on _next, also if it is buffered but behind a full buffer
+  void skip() {
+    auto& slot = _slots[_next % SLOT_COUNT];
+    if (slot.used && slot.sequence == _next) {
+      slot.used = false;
+    }
+    _stats.lost++;
+    _next++;
+  }
+
+public:
+  explicit UDPLinkReceiver(const UDPLinkReceiverOptions& options = {}) : _options{options} {
+    // nothing
+  }
+
+  inline uint32_t delayUs() const {
+    uint32_t delay = (_jitter_16 >> 4) * _options.jitter_factor;
+    return delay < _options.min_delay_us ? _options.min_delay_us : delay > _options.max_delay_us ? _options.max_delay_us : delay;
+  }
+
+  inline uint32_t jitterUs() const {
+    return _jitter_16 >> 4;
+  }
+
+  void push(const uint8_t* datagram, size_t size, uint32_t now_us) {
+    UDPLinkHeader header;
+    if (size < sizeof(header)) {
+      return;
+    }
+    memcpy(&header, datagram, sizeof(header));
+    _stats.datagrams++;
+
+    updateTransit(header.sent_at_us, now_us);
+    uint32_t playout_us = header.sent_at_us + _base_transit + delayUs();
+
+    // first datagram, or the sender restarted its sequence
+    if (!_started || before(header.sequence + SEQUENCE_RESTART_DISTANCE, _next)) {
+      _started = true;
+      _next = header.sequence;
+      for (auto& slot : _slots) {
+        slot.used = false;
+      }
+    }
+
+    size_t offset = sizeof(header);
+    for (uint8_t i = 0; i < header.count && offset + sizeof(UDPLinkChunk) <= size; i++) {
+      UDPLinkChunk chunk;
+      memcpy(&chunk, &datagram[offset], sizeof(chunk));
+      offset += sizeof(chunk);
+      if (offset + chunk.len > size || chunk.len > UDP_LINK_MAX_PAYLOAD_SIZE) {
+        return;
+      }
+      auto payload = &datagram[offset];
+      offset += chunk.len;
+
+      uint32_t sequence = header.sequence - chunk.age;
+      if (before(sequence, _next)) {
+        if (chunk.age == 0) {
+          _stats.late++;
+        }
+        continue;
+      }
+
+      // too far ahead for the buffer, give up on the oldest gaps
+      while (sequence - _next >= SLOT_COUNT) {
+        skip();
+      }
+
+      auto& slot = _slots[sequence % SLOT_COUNT];
+      if (slot.used && slot.sequence == sequence) {
+        _stats.duplicates++;
+        continue;
+      }
+
+      slot.used = true;
+      slot.sequence = sequence;
+      slot.playout_us = playout_us;
+      slot.len = chunk.len;
+      memcpy(slot.payload.data(), payload, chunk.len);
+      if (chunk.age) {
+        _stats.recovered++;
+      }
+    }
+  }
+
+  // calls fn(payload, len) for every payload due at now_us, in sequence order.
+  // fn returns false to stop, the payload is offered again on the next call
+  template <typename F>
+  void pop(uint32_t now_us, F&& fn) {
+    while (true) {
+      auto& slot = _slots[_next % SLOT_COUNT];
+      if (slot.used && slot.sequence == _next) {
+        if (before(now_us, slot.playout_us)) {
+          return;
+        }
+        if (!fn(slot.payload.data(), slot.len)) {
+          return;
+        }
+        slot.used = false;
+        _stats.played++;
+        _next++;
+        continue;
+      }
+
+      // a gap, skip it once a newer payload is due
+      auto newer_due = false;
+      for (auto& other : _slots) {
+        if (other.used && before(_next, other.sequence) && !before(now_us, other.playout_us)) {
+          newer_due = true;
+          break;
+        }
+      }
+      if (!newer_due) {
+        return;
+      }
+      skip();
+    }
+  }
+
+  // earliest playout time of a buffered payload, false if nothing is buffered
+  bool nextPlayout(uint32_t& at_us) const {
+    auto found = false;
+    for (auto& slot : _slots) {
+      if (slot.used && (!found || before(slot.playout_us, at_us))) {
+        at_us = slot.playout_us;
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  inline const Stats& stats() const {
+    return _stats;
+  }
+};
+} // namespace rc
@@ -17,6 +17,25 @@ This is a licence-free software, it can be used by anyone who try to build a bet
 
 #include "serialib.h"
 
+#if defined (__linux__) && defined (TCGETS2)
+// struct termios2 from <asm/termbits.h>, which can not be included together with <termios.h>
+struct serialib_termios2
+{
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#define SERIALIB_TCGETS2 _IOR('T', 0x2A, struct serialib_termios2)
+#define SERIALIB_TCSETS2 _IOW('T', 0x2B, struct serialib_termios2)
+#define SERIALIB_BOTHER 0010000
+#endif
+
 
 
 //_____________________________________
@@ -140,6 +159,10 @@ serialib::~serialib()
      \return -7 Databits not recognized
      \return -8 Stopbits not recognized
      \return -9 Parity not recognized
+
+     On Linux any baud rate is accepted, rates without a Bxxxx constant are set through termios2/BOTHER.
+     The device is put in raw mode, the applied settings are read back and -5 is returned if the driver
+     did not take them. ASYNC_LOW_LATENCY is requested where the driver supports it.
   */
 char serialib::openDevice(const char *Device, const unsigned int Bauds,
                           SerialDataBits Databits,
@@ -309,7 +332,12 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
 #if defined (B4000000)
     case 4000000 :   Speed=B4000000; break;
 #endif
+#if defined (__linux__) && defined (TCSETS2)
+    // Set through termios2 once the rest of the options are written
+    default : Speed=B38400; break;
+#else
     default : return -4;
+#endif
     }
     int databits_flag = 0;
     switch(Databits) {
@@ -339,8 +367,11 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     // Set the baud rate
     cfsetispeed(&options, Speed);
     cfsetospeed(&options, Speed);
+    // Raw mode: no echo, no canonical input, no signal chars, no output or input processing
+    cfmakeraw(&options);
     // Configure the device : data bits, stop bits, parity, no control flow
     // Ignore modem control lines (CLOCAL) and Enable receiver (CREAD)
+    options.c_cflag &= ~( CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS );
     options.c_cflag |= ( CLOCAL | CREAD | databits_flag | parity_flag | stopbits_flag);
     options.c_iflag |= ( IGNPAR | IGNBRK );
     // Timer unused
@@ -348,7 +379,40 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     // At least on character before satisfy reading
     options.c_cc[VMIN]=0;
     // Activate the settings
-    tcsetattr(fd, TCSANOW, &options);
+    if (tcsetattr(fd, TCSANOW, &options)!=0) return -5;
+
+#if defined (__linux__) && defined (TCSETS2)
+    // Rates without a Bxxxx constant are given to the driver as a plain number
+    if (cfgetospeed(&options)==B38400 && Bauds!=38400)
+    {
+        serialib_termios2 options2;
+        if (ioctl(fd, SERIALIB_TCGETS2, &options2)!=0) return -3;
+        options2.c_cflag &= ~CBAUD;
+        options2.c_cflag |= SERIALIB_BOTHER;
+        options2.c_ispeed = Bauds;
+        options2.c_ospeed = Bauds;
+        if (ioctl(fd, SERIALIB_TCSETS2, &options2)!=0) return -4;
+    }
+#endif
+
+    // Read the settings back, tcsetattr succeeds if any of them was applied
+    struct termios applied;
+    if (tcgetattr(fd, &applied)!=0) return -3;
+    if ((applied.c_lflag & (ICANON | ECHO | ISIG | IEXTEN)) ||
+        (applied.c_oflag & OPOST) ||
+        (applied.c_iflag & (ICRNL | IXON | ISTRIP)) ||
+        (applied.c_cflag & CSIZE)!=(tcflag_t)databits_flag ||
+        applied.c_cc[VMIN]!=0 || applied.c_cc[VTIME]!=0) return -5;
+
+#if defined (__linux__)
+    // Ask the driver to push received bytes to the tty right away, not every driver supports it
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial)==0)
+    {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &serial);
+    }
+#endif
     // Success
     return (1);
 #endif
@@ -365,6 +429,63 @@ bool serialib::isDeviceOpen()
 #endif
 }
 
+#if defined (__linux__) || defined(__APPLE__)
+/*!
+     \brief Open a device in place of the current one (UNIX only)
+            The new device is dup2()'ed onto the current file descriptor, so a thread
+            writing to the device concurrently never sees a closed or reused descriptor
+     \param Device : Port name
+     \param Bauds : Baud rate of the serial port
+     \return 1 success
+     \return same error codes as openDevice, -2 if the descriptor could not be replaced
+  */
+char serialib::reopenDevice(const char *Device, const unsigned int Bauds)
+{
+    serialib next;
+    char ret=next.openDevice(Device, Bauds);
+    if (ret!=1) return ret;
+
+    // Nothing to replace, take over the new descriptor
+    if (fd<0)
+    {
+        fd=next.fd;
+        next.fd=-1;
+        return 1;
+    }
+
+    // Atomically swap the device behind the descriptor, next closes its own copy
+    if (dup2(next.fd, fd)<0) return -2;
+    return 1;
+}
+
+
+
+/*!
+     \brief Replace the current device by /dev/null (UNIX only)
+            Used when the device is gone: writes keep succeeding and the descriptor
+            stays valid until reopenDevice() puts a device behind it again
+     \return 1 success
+     \return -2 error while opening /dev/null
+  */
+char serialib::detachDevice()
+{
+    int null=open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null<0) return -2;
+
+    if (fd<0)
+    {
+        fd=null;
+        return 1;
+    }
+
+    dup2(null, fd);
+    close(null);
+    return 1;
+}
+#endif
+
+
+
 /*!
      \brief Close the connection with the current device
 */
@@ -661,9 +782,9 @@ int serialib::readString(char *receivedString,char finalChar,unsigned int maxNbB
      \param buffer : array of bytes read from the serial device
      \param maxNbBytes : maximum allowed number of bytes read
      \param timeOut_ms : delay of timeout before giving up the reading
-     \param sleepDuration_us : delay of CPU relaxing in microseconds (Linux only)
-            In the reading loop, a sleep can be performed after each reading
-            This allows CPU to perform other tasks
+     \param sleepDuration_us : unused, kept for compatibility (Linux only)
+            The reading loop blocks in poll() until the device is readable
+            or the remaining time of the timeout elapsed
      \return >=0 return the number of bytes read before timeout or
                 requested data is completed
      \return -1 error while setting the Timeout
@@ -692,39 +813,153 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
     return dwBytesRead;
 #endif
 #if defined (__linux__) || defined(__APPLE__)
-    // Timer used for timeout
-    timeOut          timer;
-    // Initialise the timer
-    timer.initTimer();
+    // Avoid warning while compiling
+    UNUSED(sleepDuration_us);
+
+    // Absolute deadline of the read
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeOut_ms / 1000;
+    deadline.tv_nsec += (timeOut_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
     unsigned int     NbByteRead=0;
-    // While Timeout is not reached
-    while (timer.elapsedTime_ms()<timeOut_ms || timeOut_ms==0)
+    while (NbByteRead<maxNbBytes)
     {
         // Compute the position of the current byte
         unsigned char* Ptr=(unsigned char*)buffer+NbByteRead;
-        // Try to read a byte on the device
+        // Try to read the remaining bytes on the device
         int Ret=read(fd,(void*)Ptr,maxNbBytes-NbByteRead);
-        // Error while reading
-        if (Ret==-1) return -2;
-
         // One or several byte(s) has been read on the device
         if (Ret>0)
         {
             // Increase the number of read bytes
             NbByteRead+=Ret;
-            // Success : bytes has been read
-            if (NbByteRead>=maxNbBytes)
-                return NbByteRead;
+            continue;
         }
-        // Suspend the loop to avoid charging the CPU
-        usleep (sleepDuration_us);
+        // Error while reading
+        if (Ret==-1 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) return -2;
+
+        // Nothing pending, compute the exact remaining time
+        struct timespec remaining;
+        if (timeOut_ms!=0)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0)
+            {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000L;
+            }
+            // Timeout reached
+            if (remaining.tv_sec < 0) break;
+        }
+
+        // Sleep until the device is readable (no timeout if timeOut_ms is zero)
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+#if defined (__linux__)
+        int Ready=ppoll(&pfd, 1, timeOut_ms!=0 ? &remaining : NULL, NULL);
+#else
+        int Ready=poll(&pfd, 1, timeOut_ms!=0 ? (int)(remaining.tv_sec*1000 + (remaining.tv_nsec+999999)/1000000) : -1);
+#endif
+        // Error while waiting
+        if (Ready<0 && errno!=EINTR) return -2;
+        // Timeout reached
+        if (Ready==0) break;
+        // Device is gone
+        if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) && !(pfd.revents & POLLIN)) return -2;
     }
-    // Timeout reached, return the number of bytes read
+    // Return the number of bytes read
     return NbByteRead;
 #endif
 }
 
 
+/*!
+     \brief Read every byte available right now into a ring buffer supplied by the caller, without blocking
+     \param ring : storage of the ring buffer
+     \param ringSize : size of the ring buffer in bytes
+     \param head : free running write position of the ring, advanced by the number of bytes read
+     \param tail : free running read position of the ring (the caller consumes up to head)
+     \return >=0 the number of bytes read, 0 if nothing was pending or the ring is full
+     \return -2 error while reading
+  */
+int serialib::readAvailable(unsigned char *ring, unsigned int ringSize, unsigned int *head, unsigned int tail)
+{
+#if defined (_WIN32) || defined(_WIN64)
+    int NbByteRead=0;
+    while (*head-tail<ringSize)
+    {
+        // Free space of the ring, up to its end
+        unsigned int Free=ringSize-(*head-tail);
+        unsigned int Offset=*head%ringSize;
+        unsigned int First=ringSize-Offset < Free ? ringSize-Offset : Free;
+        // Only read what is pending so ReadFile does not block
+        int Pending=available();
+        if (Pending<=0) break;
+        int Ret=readBytes(ring+Offset, (unsigned int)Pending<First ? Pending : First, 1);
+        if (Ret<0) return Ret;
+        // Nothing pending anymore
+        if (Ret==0) break;
+        *head+=Ret;
+        NbByteRead+=Ret;
+    }
+    return NbByteRead;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    return readAvailable(fd, ring, ringSize, head, tail);
+#endif
+}
+
+
+#if defined (__linux__) || defined(__APPLE__)
+/*!
+     \brief Read every byte available right now from a non-blocking file descriptor into a ring buffer, without blocking
+     \param fd : file descriptor to read from
+     \param ring : storage of the ring buffer
+     \param ringSize : size of the ring buffer in bytes
+     \param head : free running write position of the ring, advanced by the number of bytes read
+     \param tail : free running read position of the ring (the caller consumes up to head)
+     \return >=0 the number of bytes read, 0 if nothing was pending or the ring is full
+     \return -2 error while reading
+  */
+int serialib::readAvailable(int fd, unsigned char *ring, unsigned int ringSize, unsigned int *head, unsigned int tail)
+{
+    int NbByteRead=0;
+    while (*head-tail<ringSize)
+    {
+        // Free space of the ring, possibly wrapping around its end
+        unsigned int Free=ringSize-(*head-tail);
+        unsigned int Offset=*head%ringSize;
+        unsigned int First=ringSize-Offset < Free ? ringSize-Offset : Free;
+        // Fill both free regions with a single syscall
+        struct iovec iov[2];
+        iov[0].iov_base = ring+Offset;
+        iov[0].iov_len = First;
+        iov[1].iov_base = ring;
+        iov[1].iov_len = Free-First;
+        int Ret=readv(fd, iov, Free>First ? 2 : 1);
+        // Error while reading
+        if (Ret==-1 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) return -2;
+        // Nothing pending anymore
+        if (Ret<=0) break;
+        *head+=Ret;
+        NbByteRead+=Ret;
+    }
+    return NbByteRead;
+}
+#endif
+
+
 
 
 // _________________________
@@ -779,6 +1014,49 @@ int serialib::available()
 }
 
 
+#if defined (__linux__) || defined(__APPLE__)
+/*!
+    \brief  Return the file descriptor of the opened device (UNIX only)
+            Allows the device to be multiplexed with poll/epoll
+    \return The file descriptor, -1 if no device is open
+*/
+int serialib::fileDescriptor() const
+{
+    return fd;
+}
+#endif
+
+
+
+#if defined (__linux__)
+/*!
+    \brief Return the output baud rate the driver actually applied, which can differ from the requested one
+    \return the baud rate, 0 if it could not be read
+*/
+unsigned int serialib::effectiveBauds() const
+{
+#if defined (TCGETS2)
+    serialib_termios2 options2;
+    if (ioctl(fd, SERIALIB_TCGETS2, &options2)==0) return options2.c_ospeed;
+#endif
+    return 0;
+}
+
+
+
+/*!
+    \brief Check if the driver delivers received bytes without batching them (ASYNC_LOW_LATENCY)
+    \return true if the flag is set, false if it is not or the driver does not support it
+*/
+bool serialib::isLowLatency() const
+{
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial)!=0) return false;
+    return (serial.flags & ASYNC_LOW_LATENCY)!=0;
+}
+#endif
+
+
 
 // __________________
 // ::: I/O Access :::
@@ -50,6 +50,14 @@ This is a licence-free software, it can be used by anyone who try to build a bet
     #include <fcntl.h>
     #include <unistd.h>
     #include <sys/ioctl.h>
+    #include <sys/uio.h>
+    #include <poll.h>
+    #include <errno.h>
+    #include <time.h>
+#endif
+#if defined (__linux__)
+    // ASYNC_LOW_LATENCY and the serial_struct used to set it
+    #include <linux/serial.h>
 #endif
 
 /*! To avoid unused parameters */
@@ -119,6 +127,14 @@ public:
     // Check device opening state
     bool isDeviceOpen();
 
+#if defined (__linux__) || defined(__APPLE__)
+    // Open a device in place of the current one, keeping the file descriptor (UNIX only)
+    char    reopenDevice(const char *Device, const unsigned int Bauds);
+
+    // Replace the current device by /dev/null, keeping the file descriptor (UNIX only)
+    char    detachDevice();
+#endif
+
     // Close the current device
     void    closeDevice();
 
@@ -164,6 +180,13 @@ public:
     // Read an array of byte (with timeout)
     int     readBytes   (void *buffer,unsigned int maxNbBytes,const unsigned int timeOut_ms=0, unsigned int sleepDuration_us=100);
 
+    // Read every byte available right now into a caller supplied ring buffer
+    int     readAvailable(unsigned char *ring, unsigned int ringSize, unsigned int *head, unsigned int tail);
+#if defined (__linux__) || defined(__APPLE__)
+    // Same for any non-blocking file descriptor, shared with the socket transports (UNIX only)
+    static int readAvailable(int fd, unsigned char *ring, unsigned int ringSize, unsigned int *head, unsigned int tail);
+#endif
+
 
 
 
@@ -177,6 +200,19 @@ public:
     // Return the number of bytes in the received buffer
     int     available();
 
+#if defined (__linux__) || defined(__APPLE__)
+    // Return the file descriptor of the device (UNIX only)
+    int     fileDescriptor() const;
+#endif
+
+#if defined (__linux__)
+    // Return the output baud rate the driver actually applied (Linux only)
+    unsigned int effectiveBauds() const;
+
+    // Return true if the driver reports ASYNC_LOW_LATENCY (Linux only)
+    bool    isLowLatency() const;
+#endif
+
 
 
 
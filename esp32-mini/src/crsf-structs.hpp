@@ -62,6 +62,60 @@ struct PACKED ChannelsPacked {
   uint16_t ch13 : 11 = CHANNEL_VALUE_MIN;
   uint16_t ch14 : 11 = CHANNEL_VALUE_MIN;
   uint16_t ch15 : 11 = CHANNEL_VALUE_MIN;
+
+  // by index, 0 is aileron
+  void set(uint8_t channel, uint16_t value) {
+    switch (channel) {
+    case 0:
+      aileron = value;
+      break;
+    case 1:
+      elevator = value;
+      break;
+    case 2:
+      throttle = value;
+      break;
+    case 3:
+      rudder = value;
+      break;
+    case 4:
+      aux1 = value;
+      break;
+    case 5:
+      aux2 = value;
+      break;
+    case 6:
+      aux3 = value;
+      break;
+    case 7:
+      aux4 = value;
+      break;
+    case 8:
+      aux5 = value;
+      break;
+    case 9:
+      aux6 = value;
+      break;
+    case 10:
+      aux7 = value;
+      break;
+    case 11:
+      aux8 = value;
+      break;
+    case 12:
+      ch12 = value;
+      break;
+    case 13:
+      ch13 = value;
+      break;
+    case 14:
+      ch14 = value;
+      break;
+    case 15:
+      ch15 = value;
+      break;
+    }
+  }
 };
 
 constexpr auto EXT_HEADER_BEGIN = 0x28;
@@ -180,6 +234,15 @@ union ParameterValue {
   } string_value;
 };
 
+// follows the null terminated device name of a DEVICE_INFO frame, big endian
+struct PACKED DeviceInfoTail {
+  uint32_t serial_number;
+  uint32_t hardware_id;
+  uint32_t firmware_id;
+  uint8_t parameters_total;
+  uint8_t parameter_version;
+};
+
 struct PACKED ParameterWrite {
   uint8_t parameter;
   ParameterValue value;
@@ -65,18 +65,26 @@ void Transmitter::readRemoteFrame(std::span<const uint8_t> payload) {
 }
 
 void Transmitter::readSettingsEntry(std::span<const uint8_t> payload) {
+  if (payload.size() < 2) {
+    return;
+  }
   auto param_header = (ParameterHeader*)payload.data();
 
+  // a chunk of another parameter than the one being assembled starts over
+  if (_settings_buffer_len > 0 && param_header->parameter != _settings_entry.id) {
+    _settings_buffer_len = 0;
+  }
   if (_settings_buffer_len == 0) {
     _settings_entry.id = param_header->parameter;
-    _settings_entry.data_type = param_header->data_type;
-    _settings_entry.name = param_header->name;
-    _settings_entry.value = 0.0;
   }
 
-  auto param_header_len = (_settings_buffer_len == 0) ? (sizeof(ParameterHeader) + (strlen(param_header->name) + 1)) : 2;
-  auto param_chunk_len = payload.size() - param_header_len;
-  memcpy(&_settings_buffer[_settings_buffer_len], &payload[param_header_len], param_chunk_len);
+  // every chunk continues the entry after its parameter and chunks_remaining bytes
+  auto param_chunk_len = payload.size() - 2;
+  if (_settings_buffer_len + param_chunk_len > sizeof(_settings_buffer)) {
+    _settings_buffer_len = 0;
+    return;
+  }
+  memcpy(&_settings_buffer[_settings_buffer_len], &payload[2], param_chunk_len);
   _settings_buffer_len += param_chunk_len;
 
   if (param_header->chunks_remaining > 0) {
@@ -84,18 +92,40 @@ void Transmitter::readSettingsEntry(std::span<const uint8_t> payload) {
     return;
   }
 
-  auto param_value = (ParameterValue*)_settings_buffer;
-  switch (_settings_entry.data_type) {
+  std::span<const uint8_t> entry{STD_SPAN_ARGS(_settings_buffer, _settings_buffer_len)};
+  _settings_buffer_len = 0;
+  if (entry.size() < 3) {
+    return;
+  }
+
+  auto name_len = strnlen((const char*)&entry[2], entry.size() - 2);
+  _settings_entry.folder = entry[0];
+  _settings_entry.data_type = entry[1];
+  _settings_entry.name.assign((const char*)&entry[2], name_len);
+  _settings_entry.value = 0.0;
+  _settings_entry.entry = entry;
+
+  // the value follows the name, the high bit of the type marks hidden entries
+  auto value_offset = 2 + name_len + 1;
+  auto param_value = (ParameterValue*)&_settings_buffer[value_offset];
+  switch (_settings_entry.data_type & 0x7F) {
   case 0x08:
-    _settings_entry.value = (double)param_value->float_value.value; // TODO: needs more work
-    break;
-  case 0x09:
-    param_value = (ParameterValue*)&_settings_buffer[strlen((char*)_settings_buffer) + 1];
-    _settings_entry.value = (uint8_t)param_value->text_selection.value;
+    if (value_offset + sizeof(param_value->float_value.value) <= entry.size()) {
+      _settings_entry.value = (double)param_value->float_value.value; // TODO: needs more work
+    }
     break;
+  case 0x09: {
+    auto options_len = strnlen((const char*)param_value, entry.size() - std::min(value_offset, entry.size()));
+    if (value_offset + options_len + 1 < entry.size()) {
+      param_value = (ParameterValue*)&_settings_buffer[value_offset + options_len + 1];
+      _settings_entry.value = (uint8_t)param_value->text_selection.value;
+    }
+  } break;
   case 0x0A:
   case 0x0C:
-    _settings_entry.value = (std::string)param_value->string_value.value;
+    if (value_offset < entry.size()) {
+      _settings_entry.value = std::string{(const char*)param_value, strnlen((const char*)param_value, entry.size() - value_offset)};
+    }
     break;
   default:
     // TODO: log
@@ -105,8 +135,28 @@ void Transmitter::readSettingsEntry(std::span<const uint8_t> payload) {
   if (on_settings_entry) {
     on_settings_entry(_settings_entry);
   }
+}
 
-  _settings_buffer_len = 0;
+void Transmitter::readDeviceInfo(std::span<const uint8_t> payload) {
+  auto name_len = strnlen((const char*)payload.data(), payload.size());
+  if (name_len + 1 + sizeof(DeviceInfoTail) > payload.size()) {
+    return;
+  }
+
+  DeviceInfoTail tail;
+  memcpy(&tail, &payload[name_len + 1], sizeof(tail));
+
+  DeviceInfo device_info;
+  device_info.name.assign((const char*)payload.data(), name_len);
+  device_info.serial_number = __builtin_bswap32(tail.serial_number);
+  device_info.hardware_id = __builtin_bswap32(tail.hardware_id);
+  device_info.firmware_id = __builtin_bswap32(tail.firmware_id);
+  device_info.parameters_total = tail.parameters_total;
+  device_info.parameter_version = tail.parameter_version;
+
+  if (on_device_info) {
+    on_device_info(device_info);
+  }
 }
 
 void Transmitter::readMavlinkTelemetry(std::span<const uint8_t> payload) {
@@ -154,6 +204,10 @@ void Transmitter::read(const Header& header, std::span<const uint8_t> payload) {
     readSettingsEntry(payload);
     break;
 
+  case FRAMETYPE_DEVICE_INFO:
+    readDeviceInfo(payload);
+    break;
+
   case FRAMETYPE_MAVLINK_ENVELOPE:
     readMavlinkTelemetry(payload);
     break;
@@ -179,6 +233,8 @@ void Transmitter::tick() {
       _send_channels = false;
 
       writeChannels();
+      channels_written_at_us = micros();
+      channels_written++;
     } else {
       _send_channels = true;
 
@@ -28,9 +28,21 @@
 namespace crsf {
 struct Parameter {
   uint8_t id;
+  uint8_t folder;
   uint8_t data_type;
   std::string name;
   std::variant<double, uint8_t, std::string> value;
+  // the reassembled entry from the folder byte on, only valid inside on_settings_entry
+  std::span<const uint8_t> entry;
+};
+
+struct DeviceInfo {
+  std::string name;
+  uint32_t serial_number;
+  uint32_t hardware_id;
+  uint32_t firmware_id;
+  uint8_t parameters_total;
+  uint8_t parameter_version;
 };
 
 class Transmitter;
@@ -72,6 +84,11 @@ public:
     push({FRAMETYPE_PARAMETER_WRITE, ADDRESS_TX, ADDRESS_RC, parameter, value});
   }
 
+  // the module answers with a DEVICE_INFO frame
+  inline void push_device_ping() {
+    push({FRAMETYPE_DEVICE_PING, ADDRESS_TX, ADDRESS_RC});
+  }
+
   inline std::span<const uint8_t> front() const noexcept {
     return _queue.front();
   }
@@ -112,12 +129,17 @@ private:
 
   void readSettingsEntry(std::span<const uint8_t> payload);
 
+  void readDeviceInfo(std::span<const uint8_t> payload);
+
   void readMavlinkTelemetry(std::span<const uint8_t> payload);
 
   void read(const Header& header, std::span<const uint8_t> payload);
 
 public:
   ChannelsPacked channels;
+  // number of channels frames written and micros() when the last one was on the wire
+  uint32_t channels_written = 0;
+  uint32_t channels_written_at_us = 0;
 
   TransmitQueue tx_queue;
 
@@ -127,6 +149,8 @@ public:
 
   std::function<void(const Parameter&)> on_settings_entry;
 
+  std::function<void(const DeviceInfo&)> on_device_info;
+
   std::function<void(std::span<const uint8_t>)> on_mavlink_telemetry;
 
   explicit Transmitter(HardwareSerial& serial) : _serial{serial} {
@@ -1,22 +1,81 @@
 #include "BasicTimer.hpp"
 #include "crsf.hpp"
 #include "esp32mini.hpp"
+#include "rc-framing.hpp"
+#include "rc-messages.hpp"
 #include "rc-protocol.hpp"
 #include <Arduino.h>
 
 class RCGamepad {
+private:
+  static inline rc::FrameDecoder _decoder;
+
+  // what the host told us in its hello, everything until it did
+  static inline uint32_t _host_events = UINT32_MAX;
+  static inline bool _host_compatible = true;
+  static inline bool _hello_received = false;
+
+  static inline rc::Hello localHello(uint8_t flags) {
+    return {rc::PROTOCOL_VERSION, rc::PROTOCOL_MIN_VERSION, rc::FRAME_MAX_PAYLOAD_SIZE, flags, rc::GamepadMessages::acceptedEvents(), rc::FEATURE_BATCHING};
+  }
+
+  static inline void onHello(const rc::Hello& host) {
+    _host_compatible = rc::compatible(localHello(0), host);
+    _host_events = host.accepted_events;
+    _hello_received = true;
+    if (host.flags & rc::HELLO_REQUEST) {
+      sendHello(0);
+    }
+  }
+
 public:
+  // also sent unasked on boot, so a host that opened the port before us learns what we speak
+  static inline void sendHello(uint8_t flags) {
+    uint8_t frame[rc::FRAME_MAX_SIZE];
+    Serial.write(frame, rc::encodeFrame(rc::FRAME_HELLO, localHello(flags), frame));
+  }
+
   static inline void write(const rc::RemoteEvent& remote_event) {
-    Serial.write((uint8_t*)&remote_event, sizeof(remote_event));
+    if (!_host_compatible || !(_host_events & rc::eventBit(remote_event.type))) {
+      return;
+    }
+    uint8_t frame[rc::FRAME_MAX_SIZE];
+    Serial.write(frame, rc::RemoteMessages::encode(remote_event, frame));
   }
 
-  static inline void read(rc::GamepadEvent& gamepad_event) {
-    Serial.readBytes((uint8_t*)&gamepad_event, sizeof(gamepad_event));
+  // consumes pending bytes until a complete GamepadEvent frame was decoded.
+  // events from a host whose protocol version we do not speak are dropped, their layout is unknown
+  static inline bool read(rc::GamepadEvent& gamepad_event) {
+    while (Serial.available()) {
+      if (!_decoder.push(Serial.read())) {
+        continue;
+      }
+
+      switch (_decoder.type()) {
+      case rc::FRAME_GAMEPAD_EVENT:
+        if (_host_compatible && rc::GamepadMessages::decode(_decoder.payload(), _decoder.payloadSize(), gamepad_event)) {
+          return true;
+        }
+        break;
+      case rc::FRAME_HELLO: {
+        rc::Hello hello;
+        if (_decoder.payloadAs(hello)) {
+          onHello(hello);
+        }
+      } break;
+      }
+    }
+    return false;
   }
 
   static inline bool available() {
     return Serial.available();
   }
+
+  // true once after every hello from the host
+  static inline bool takeHello() {
+    return std::exchange(_hello_received, false);
+  }
 };
 
 static crsf::Transmitter crsf_serial{Serial0};
@@ -25,19 +84,141 @@ static rc::GamepadEvent gamepad_event;
 static rc::RemoteEvent remote_event;
 
 static int16_t axis_positions[rc::SDL_GAMEPAD_AXIS_COUNT] = {0};
+static uint32_t buttons = 0;
+// the host sends PAD_EVENT_CRSF_CHANNELS, the sticks arrive in crsf units instead of raw axes
+static bool host_shaped = false;
 
 static BasicTimer report_timer{500};
 
+// pong held back until the channels received before its ping went out on the crsf wire
+static rc::RemoteEvent pending_pong;
+static bool pong_pending = false;
+static uint32_t pong_channels_written = 0;
+
 static bool armed = false;
+// last position of a host mapped arm switch
+static bool arm_switch = false;
+
+// the host keys its parameter cache by this, it is resent on every hello
+static rc::RemoteEvent device_info_event;
+static bool has_device_info = false;
+
+// parameter entries the host asked for, read back to back without a round trip to the host in between
+static std::deque<uint8_t> entry_reads;
+static int16_t entry_in_flight = -1;
+static uint32_t entry_read_at_ms = 0;
+// an entry the module does not answer is skipped, the host asks again
+static constexpr uint32_t ENTRY_READ_TIMEOUT_MS = 200;
+
+static void readNextEntry() {
+  if (entry_in_flight >= 0 && millis() - entry_read_at_ms < ENTRY_READ_TIMEOUT_MS) {
+    return;
+  }
+  entry_in_flight = -1;
+  if (entry_reads.empty()) {
+    return;
+  }
+  entry_in_flight = entry_reads.front();
+  entry_reads.pop_front();
+  entry_read_at_ms = millis();
+  crsf_serial.tx_queue.push_parameter_read(entry_in_flight);
+}
+
+static void reportEntry(const crsf::Parameter& param) {
+  rc::RemoteEvent entry_event;
+  entry_event.type = rc::RemoteEvent::RC_EVENT_REPORT_PARAMETER_ENTRY;
+  auto& slice = entry_event.report_parameter_entry;
+  slice.parameter = param.id;
+  slice.total = param.entry.size();
+  for (size_t offset = 0; offset < param.entry.size(); offset += sizeof(slice.data)) {
+    slice.offset = offset;
+    slice.len = std::min(param.entry.size() - offset, sizeof(slice.data));
+    memcpy(slice.data, &param.entry[offset], slice.len);
+    RCGamepad::write(entry_event);
+  }
+}
+
+static void applyAxis(crsf::ChannelsPacked& channels, uint8_t axis, int16_t value) {
+  switch (axis) {
+  case rc::SDL_GAMEPAD_AXIS_LEFTX:
+    channels.aileron = map(value, INT16_MIN, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
+    break;
+  case rc::SDL_GAMEPAD_AXIS_LEFTY:
+    channels.throttle = map(std::max<int16_t>(value * -1, 0), 0, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
+    break;
+  case rc::SDL_GAMEPAD_AXIS_RIGHTX:
+    channels.rudder = map(value, INT16_MIN, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
+    break;
+  case rc::SDL_GAMEPAD_AXIS_RIGHTY:
+    channels.elevator = map(value * -1, INT16_MIN, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
+    break;
+  }
+}
+
+static void showAxisPositions() {
+  led0Write({
+      constrain((uint8_t)map(axis_positions[0], INT16_MIN, INT16_MAX, 0, UINT8_MAX), (uint8_t)0, (uint8_t)UINT8_MAX),
+      constrain((uint8_t)map(axis_positions[1], INT16_MIN, INT16_MAX, 0, UINT8_MAX), (uint8_t)0, (uint8_t)UINT8_MAX),
+      0,
+  });
+}
+
+static void showChannelPositions(const crsf::ChannelsPacked& channels) {
+  led0Write({
+      (uint8_t)map(channels.aileron, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX, 0, UINT8_MAX),
+      (uint8_t)map(channels.throttle, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX, 0, UINT8_MAX),
+      0,
+  });
+}
+
+// arming wants the throttle all the way down
+static bool throttleDown(const crsf::ChannelsPacked& channels) {
+  if (host_shaped) {
+    return channels.throttle == crsf::CHANNEL_VALUE_MIN;
+  }
+  return axis_positions[rc::SDL_GAMEPAD_AXIS_LEFTY] > 24000;
+}
+
+// aux1 is the arm switch
+static void setArmed(crsf::ChannelsPacked& channels, bool state) {
+  channels.aux1 = state ? crsf::CHANNEL_VALUE_MAX : crsf::CHANNEL_VALUE_MIN;
+  if (state == armed) {
+    return;
+  }
+  armed = state;
+
+  remote_event.type = rc::RemoteEvent::RC_EVENT_REPORT_ARMED;
+  remote_event.report_armed.armed = armed;
+  RCGamepad::write(remote_event);
+}
 
 void setup() {
   Serial.begin(SERIAL_BAUD);
+  RCGamepad::sendHello(rc::HELLO_REQUEST);
 
   led0Write({255, 0, 0});
   delay(1000);
 
   crsf_serial.begin(1, 2);
+  crsf_serial.on_device_info = [](const crsf::DeviceInfo& device_info) {
+    device_info_event.type = rc::RemoteEvent::RC_EVENT_REPORT_DEVICE_INFO;
+    auto& report = device_info_event.report_device_info;
+    report.serial_number = device_info.serial_number;
+    report.hardware_id = device_info.hardware_id;
+    report.firmware_id = device_info.firmware_id;
+    report.parameters_total = device_info.parameters_total;
+    report.parameter_version = device_info.parameter_version;
+    memset(report.name, 0, sizeof(report.name));
+    memcpy(report.name, device_info.name.data(), std::min(device_info.name.size(), sizeof(report.name)));
+    has_device_info = true;
+    RCGamepad::write(device_info_event);
+  };
+  crsf_serial.tx_queue.push_device_ping();
   crsf_serial.on_settings_entry = [](const crsf::Parameter& param) {
+    if (param.id == entry_in_flight) {
+      entry_in_flight = -1;
+      reportEntry(param);
+    }
     if (param.value.index() == 1) {
       remote_event.type = rc::RemoteEvent::RC_EVENT_REPORT_PARAMETER;
       remote_event.report_parameter.parameter = param.id;
@@ -51,78 +232,130 @@ void setup() {
 
 void loop() {
   crsf_serial.tick();
+  readNextEntry();
 
-  if (RCGamepad::available()) {
-    RCGamepad::read(gamepad_event);
-    switch (gamepad_event.type) {
-    case rc::GamepadEvent::PAD_EVENT_GET_PARAMETER:
-      switch (gamepad_event.get_parameter.parameter) {
-      case rc::PARAM_PACKET_RATE:
-      case rc::PARAM_TLM_RATIO:
-      case rc::PARAM_SWITCH_MODE:
-      case rc::PARAM_LINK_MODE:
-      case rc::PARAM_MODEL_MATCH:
-      case rc::PARAM_MAX_POWER:
-      case rc::PARAM_WIFI:
-        crsf_serial.tx_queue.push_parameter_read(gamepad_event.get_parameter.parameter);
-        break;
-      }
-      break;
-
-    case rc::GamepadEvent::PAD_EVENT_SET_PARAMETER:
-      switch (gamepad_event.set_parameter.parameter) {
-      case rc::PARAM_PACKET_RATE:
-      case rc::PARAM_TLM_RATIO:
-      case rc::PARAM_SWITCH_MODE:
-      case rc::PARAM_LINK_MODE:
-      case rc::PARAM_MODEL_MATCH:
-      case rc::PARAM_MAX_POWER:
-      case rc::PARAM_WIFI:
-        if (!armed) {
-          crsf_serial.tx_queue.push_parameter_write(gamepad_event.set_parameter.parameter, (uint8_t)gamepad_event.set_parameter.value);
+  if (pong_pending && crsf_serial.channels_written != pong_channels_written) {
+    pong_pending = false;
+    pending_pong.pong.crsf_written_at_us = crsf_serial.channels_written_at_us;
+    pending_pong.pong.replied_at_us = micros();
+    RCGamepad::write(pending_pong);
+  }
+
+  if (RCGamepad::takeHello()) {
+    if (has_device_info) {
+      RCGamepad::write(device_info_event);
+    } else {
+      crsf_serial.tx_queue.push_device_ping();
+    }
+  }
+
+  if (RCGamepad::read(gamepad_event)) {
+    rc::GamepadMessages::dispatch(gamepad_event, rc::Handlers{
+      [](rc::msg::GetParameter, const auto& get_parameter) {
+        switch (get_parameter.parameter) {
+        case rc::PARAM_PACKET_RATE:
+        case rc::PARAM_TLM_RATIO:
+        case rc::PARAM_SWITCH_MODE:
+        case rc::PARAM_LINK_MODE:
+        case rc::PARAM_MODEL_MATCH:
+        case rc::PARAM_MAX_POWER:
+        case rc::PARAM_WIFI:
+          crsf_serial.tx_queue.push_parameter_read(get_parameter.parameter);
+          break;
         }
-        break;
-      }
-      break;
-
-    case rc::GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_DOWN:
-      switch (gamepad_event.button_down.button) {
-      case rc::SDL_GAMEPAD_BUTTON_WEST:
-        if (axis_positions[rc::SDL_GAMEPAD_AXIS_LEFTY] > 24000) {
-          armed = !armed;
-          crsf_serial.channels.aux1 = armed ? crsf::CHANNEL_VALUE_MAX : crsf::CHANNEL_VALUE_MIN;
-
-          remote_event.type = rc::RemoteEvent::RC_EVENT_REPORT_ARMED;
-          remote_event.report_armed.armed = armed;
-          RCGamepad::write(remote_event);
+      },
+
+      [](rc::msg::ReadParameterEntries, const auto& read_entries) {
+        for (uint8_t i = 0; i < std::min(read_entries.count, rc::PARAMETER_ENTRIES_PER_READ); i++) {
+          if (std::find(entry_reads.begin(), entry_reads.end(), read_entries.parameters[i]) == entry_reads.end()) {
+            entry_reads.push_back(read_entries.parameters[i]);
+          }
         }
-        break;
-      }
-      break;
-
-    case rc::GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION: {
-      axis_positions[gamepad_event.axis_motion.axis] = gamepad_event.axis_motion.value;
-      led0Write({
-          constrain((uint8_t)map(axis_positions[0], INT16_MIN, INT16_MAX, 0, UINT8_MAX), (uint8_t)0, (uint8_t)UINT8_MAX),
-          constrain((uint8_t)map(axis_positions[1], INT16_MIN, INT16_MAX, 0, UINT8_MAX), (uint8_t)0, (uint8_t)UINT8_MAX),
-          0,
-      });
-      switch (gamepad_event.axis_motion.axis) {
-      case rc::SDL_GAMEPAD_AXIS_LEFTX:
-        crsf_serial.channels.aileron = map(gamepad_event.axis_motion.value, INT16_MIN, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
-        break;
-      case rc::SDL_GAMEPAD_AXIS_LEFTY:
-        crsf_serial.channels.throttle = map(std::max<int16_t>(gamepad_event.axis_motion.value * -1, 0), 0, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
-        break;
-      case rc::SDL_GAMEPAD_AXIS_RIGHTX:
-        crsf_serial.channels.rudder = map(gamepad_event.axis_motion.value, INT16_MIN, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
-        break;
-      case rc::SDL_GAMEPAD_AXIS_RIGHTY:
-        crsf_serial.channels.elevator = map(gamepad_event.axis_motion.value * -1, INT16_MIN, INT16_MAX, crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX);
-        break;
-      }
-    } break;
-    }
+      },
+
+      [](rc::msg::SetParameter, const auto& set_parameter) {
+        switch (set_parameter.parameter) {
+        case rc::PARAM_PACKET_RATE:
+        case rc::PARAM_TLM_RATIO:
+        case rc::PARAM_SWITCH_MODE:
+        case rc::PARAM_LINK_MODE:
+        case rc::PARAM_MODEL_MATCH:
+        case rc::PARAM_MAX_POWER:
+        case rc::PARAM_WIFI:
+          if (!armed) {
+            crsf_serial.tx_queue.push_parameter_write(set_parameter.parameter, (uint8_t)set_parameter.value);
+          }
+          break;
+        }
+      },
+
+      [](rc::msg::ButtonDown, const auto& button_down) {
+        switch (button_down.button) {
+        case rc::SDL_GAMEPAD_BUTTON_WEST:
+          if (throttleDown(crsf_serial.channels)) {
+            setArmed(crsf_serial.channels, !armed);
+          }
+          break;
+        }
+      },
+
+      [](rc::msg::AxisMotion, const auto& axis_motion) {
+        if (axis_motion.axis < rc::SDL_GAMEPAD_AXIS_COUNT) {
+          axis_positions[axis_motion.axis] = axis_motion.value;
+          showAxisPositions();
+          applyAxis(crsf_serial.channels, axis_motion.axis, axis_motion.value);
+        }
+      },
+
+      [](rc::msg::Channels, const auto& channels_event) {
+        // build the whole frame before handing it to the transmitter so it never goes out half updated
+        auto channels = crsf_serial.channels;
+        for (uint8_t axis = 0; axis < rc::SDL_GAMEPAD_AXIS_COUNT; axis++) {
+          axis_positions[axis] = channels_event.axes[axis];
+          applyAxis(channels, axis, channels_event.axes[axis]);
+        }
+        buttons = channels_event.buttons;
+        crsf_serial.channels = channels;
+        showAxisPositions();
+      },
+
+      [](rc::msg::CrsfChannels, const auto& crsf_channels) {
+        auto channels = crsf_serial.channels;
+        for (uint8_t channel = 0; channel < rc::CRSF_CHANNEL_COUNT; channel++) {
+          if (crsf_channels.mask & (1u << channel)) {
+            channels.set(channel, constrain(crsf_channels.values[channel], crsf::CHANNEL_VALUE_MIN, crsf::CHANNEL_VALUE_MAX));
+          }
+        }
+        host_shaped = true;
+
+        // a mapped arm switch replaces the west button. it only arms when flipped on with the throttle down,
+        // a switch that is already on when the throttle comes down has to be flipped again
+        constexpr auto AUX1 = 4;
+        if (crsf_channels.mask & (1u << AUX1)) {
+          auto on = channels.aux1 >= crsf::CHANNEL_VALUE_MID;
+          auto state = armed;
+          if (on != arm_switch) {
+            arm_switch = on;
+            state = on && throttleDown(channels);
+          }
+          setArmed(channels, state);
+        }
+
+        crsf_serial.channels = channels;
+        showChannelPositions(channels);
+      },
+
+      [](rc::msg::Ping, const auto& ping) {
+        // the host sends the ping after the channels of the same tick, so they are already applied
+        pending_pong.type = rc::RemoteEvent::RC_EVENT_PONG;
+        pending_pong.pong.sequence = ping.sequence;
+        pending_pong.pong.sent_at_ns = ping.sent_at_ns;
+        pending_pong.pong.sample_age_us = ping.sample_age_us;
+        pending_pong.pong.received_at_us = micros();
+        pong_pending = true;
+        pong_channels_written = crsf_serial.channels_written;
+      },
+    });
   }
 
   if (report_timer.resetIfTicked()) {
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// framing for the rc protocol so a dropped or corrupted byte only costs the frames it touches.
+//
+//   SYNC | LEN | TYPE | PAYLOAD[LEN] | CRC8(LEN, TYPE, PAYLOAD)
+namespace rc {
+constexpr uint8_t FRAME_SYNC = 0xC5;
+constexpr uint8_t FRAME_OVERHEAD = 4;
+constexpr uint8_t FRAME_MAX_PAYLOAD_SIZE = 60;
+constexpr uint8_t FRAME_MAX_SIZE = FRAME_MAX_PAYLOAD_SIZE + FRAME_OVERHEAD;
+
+enum FrameType : uint8_t {
+  FRAME_GAMEPAD_EVENT = 0x01,
+  FRAME_REMOTE_EVENT = 0x02,
+  // rc::Hello, see rc-protocol.hpp
+  FRAME_HELLO = 0x03,
+};
+
+// crc8 with the DVB-S2 polynomial (0xD5), same as CRSF
+constexpr auto CRC8_TABLE = []() {
+  std::array<uint8_t, 256> table{};
+  for (int i = 0; i < 256; i++) {
+    uint8_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0xD5 : (crc << 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+constexpr uint8_t crc8(const uint8_t* data, size_t len, uint8_t crc = 0) {
+  for (size_t i = 0; i < len; i++) {
+    crc = CRC8_TABLE[crc ^ data[i]];
+  }
+  return crc;
+}
+
+// writes a frame to out (at least len + FRAME_OVERHEAD bytes) and returns its size
+inline size_t encodeFrame(uint8_t type, const void* payload, uint8_t len, uint8_t* out) {
+  out[0] = FRAME_SYNC;
+  out[1] = len;
+  out[2] = type;
+  memcpy(&out[3], payload, len);
+  out[3 + len] = crc8(&out[1], len + 2);
+  return len + FRAME_OVERHEAD;
+}
+
+template <typename T>
+inline size_t encodeFrame(uint8_t type, const T& payload, uint8_t* out) {
+  static_assert(sizeof(T) <= FRAME_MAX_PAYLOAD_SIZE);
+  return encodeFrame(type, &payload, sizeof(T), out);
+}
+
+// streaming decoder, fed one byte at a time.
+// on a bad length or crc it drops the sync byte and rescans the bytes it already buffered,
+// so it locks onto the next frame without losing it.
+class FrameDecoder {
+public:
+  struct Stats {
+    uint32_t frames = 0;
+    uint32_t crc_errors = 0;
+    uint32_t length_errors = 0;
+    uint32_t skipped_bytes = 0;
+  };
+
+private:
+  uint8_t _buffer[FRAME_MAX_SIZE];
+  uint8_t _len = 0;
+  // size of the frame returned by the last push(), removed on the next one
+  uint8_t _frame_size = 0;
+
+  Stats _stats;
+
+  void resync() {
+    uint8_t next = 1;
+    while (next < _len && _buffer[next] != FRAME_SYNC) {
+      next++;
+    }
+    _stats.skipped_bytes += next;
+    _len -= next;
+    memmove(_buffer, &_buffer[next], _len);
+  }
+
+  bool parse() {
+    while (_len >= 2) {
+      auto payload_len = _buffer[1];
+      if (payload_len > FRAME_MAX_PAYLOAD_SIZE) {
+        _stats.length_errors++;
+        resync();
+        continue;
+      }
+
+      uint8_t frame_size = payload_len + FRAME_OVERHEAD;
+      if (_len < frame_size) {
+        return false;
+      }
+
+      if (crc8(&_buffer[1], payload_len + 2) != _buffer[frame_size - 1]) {
+        _stats.crc_errors++;
+        resync();
+        continue;
+      }
+
+      _frame_size = frame_size;
+      _stats.frames++;
+      return true;
+    }
+    return false;
+  }
+
+public:
+  // returns true once a complete, valid frame is available through type() and payload()
+  bool push(uint8_t byte) {
+    if (_frame_size) {
+      _len -= _frame_size;
+      memmove(_buffer, &_buffer[_frame_size], _len);
+      _frame_size = 0;
+
+      if (_len && _buffer[0] != FRAME_SYNC) {
+        resync();
+      }
+      if (parse()) {
+        // a frame left over from a resync completed before this byte, keep the byte for later
+        _buffer[_len++] = byte;
+        return true;
+      }
+    }
+
+    if (!_len && byte != FRAME_SYNC) {
+      _stats.skipped_bytes++;
+      return false;
+    }
+
+    _buffer[_len++] = byte;
+    return parse();
+  }
+
+  inline uint8_t type() const {
+    return _buffer[2];
+  }
+
+  inline const uint8_t* payload() const {
+    return &_buffer[3];
+  }
+
+  inline uint8_t payloadSize() const {
+    return _buffer[1];
+  }
+
+  // copies the payload into value, zero filling what the frame did not carry
+  template <typename T>
+  inline bool payloadAs(T& value) const {
+    if (payloadSize() > sizeof(T)) {
+      return false;
+    }
+    memset((void*)&value, 0, sizeof(T));
+    memcpy((void*)&value, payload(), payloadSize());
+    return true;
+  }
+
+  inline const Stats& stats() const {
+    return _stats;
+  }
+};
+} // namespace rc
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "rc-framing.hpp"
+#include "rc-protocol.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+// typed registry of every message in rc-protocol.hpp.
+// a message is one declaration naming its event, type and union member, the registries below check
+// the sizes at compile time and generate the hello capabilities, the encoders and the dispatch tables.
+// frames carry the type and the active union member only, not the whole event.
+//
+//   rc::GamepadMessages::dispatch(gamepad_event, rc::Handlers{
+//     [](rc::msg::Ping, const auto& ping) { ... },
+//     [](rc::msg::Channels, const auto& channels) { ... },
+//   });
+namespace rc {
+template <typename Event, uint16_t Type, auto Member>
+struct Message {
+  using event_type = Event;
+  using payload_type = std::remove_cvref_t<decltype(std::declval<Event&>().*Member)>;
+  static constexpr uint16_t type = Type;
+  static constexpr auto member = Member;
+
+  static Event make(const payload_type& payload) {
+    Event event;
+    event.type = Type;
+    event.*Member = payload;
+    return event;
+  }
+};
+
+namespace msg {
+using GetParameter = Message<GamepadEvent, GamepadEvent::PAD_EVENT_GET_PARAMETER, &GamepadEvent::get_parameter>;
+using SetParameter = Message<GamepadEvent, GamepadEvent::PAD_EVENT_SET_PARAMETER, &GamepadEvent::set_parameter>;
+using Channels = Message<GamepadEvent, GamepadEvent::PAD_EVENT_CHANNELS, &GamepadEvent::channels>;
+using Ping = Message<GamepadEvent, GamepadEvent::PAD_EVENT_PING, &GamepadEvent::ping>;
+using ReadParameterEntries = Message<GamepadEvent, GamepadEvent::PAD_EVENT_READ_PARAMETER_ENTRIES, &GamepadEvent::read_parameter_entries>;
+using CrsfChannels = Message<GamepadEvent, GamepadEvent::PAD_EVENT_CRSF_CHANNELS, &GamepadEvent::crsf_channels>;
+using AxisMotion = Message<GamepadEvent, GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION, &GamepadEvent::axis_motion>;
+using ButtonDown = Message<GamepadEvent, GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_DOWN, &GamepadEvent::button_down>;
+using ButtonUp = Message<GamepadEvent, GamepadEvent::SDL_EVENT_GAMEPAD_BUTTON_UP, &GamepadEvent::button_up>;
+
+using ReportLinkStats = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_LINK_STATS, &RemoteEvent::report_link_stats>;
+using ReportTelemetry = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_TELEMETRY, &RemoteEvent::report_telemetry>;
+using ReportArmed = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_ARMED, &RemoteEvent::report_armed>;
+using ReportParameter = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_PARAMETER, &RemoteEvent::report_parameter>;
+using ReportVRXChannel = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_VRX_CHANNEL, &RemoteEvent::report_vrx_channel>;
+using ReportVRXRSSI = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_VRX_RSSI, &RemoteEvent::report_vrx_rssi>;
+using Pong = Message<RemoteEvent, RemoteEvent::RC_EVENT_PONG, &RemoteEvent::pong>;
+using ReportDeviceInfo = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_DEVICE_INFO, &RemoteEvent::report_device_info>;
+using ReportParameterEntry = Message<RemoteEvent, RemoteEvent::RC_EVENT_REPORT_PARAMETER_ENTRY, &RemoteEvent::report_parameter_entry>;
+} // namespace msg
+
+// overload set of handler lambdas for dispatch()
+template <typename... F>
+struct Handlers : F... {
+  using F::operator()...;
+};
+
+template <typename... F>
+Handlers(F...) -> Handlers<F...>;
+
+template <uint8_t Frame, typename Event, typename... Messages>
+class MessageRegistry {
+private:
+  static_assert((std::is_same_v<Event, typename Messages::event_type> && ...), "message registered with the wrong event");
+  static_assert(((eventIndex(Messages::type) < EVENT_INDEX_COUNT) && ...), "message type has no event index");
+  static_assert(((sizeof(Event::type) + sizeof(typename Messages::payload_type) <= FRAME_MAX_PAYLOAD_SIZE) && ...), "message does not fit in a frame");
+  static_assert(sizeof(Event) <= FRAME_MAX_PAYLOAD_SIZE);
+
+  static constexpr bool uniqueTypes() {
+    uint32_t seen = 0;
+    for (auto bit : {eventBit(Messages::type)...}) {
+      if (seen & bit) {
+        return false;
+      }
+      seen |= bit;
+    }
+    return true;
+  }
+  static_assert(uniqueTypes(), "two messages share a type");
+
+  static constexpr auto SIZES = []() {
+    std::array<uint8_t, EVENT_INDEX_COUNT> sizes{};
+    ((sizes[eventIndex(Messages::type)] = sizeof(Event::type) + sizeof(typename Messages::payload_type)), ...);
+    return sizes;
+  }();
+
+  template <typename M, typename H>
+  static void call(const Event& event, H& handlers) {
+    handlers(M{}, event.*M::member);
+  }
+
+public:
+  template <typename M>
+  static constexpr bool contains = (std::is_same_v<M, Messages> || ...);
+
+  static constexpr uint32_t acceptedEvents() {
+    return (eventBit(Messages::type) | ... | 0u);
+  }
+
+  // frame payload size of a message: its type plus the active union member, 0 if the type is not registered
+  static constexpr uint8_t sizeOf(uint16_t type) {
+    return eventIndex(type) < EVENT_INDEX_COUNT ? SIZES[eventIndex(type)] : 0;
+  }
+
+  // writes the frame of an event to out (at least FRAME_MAX_SIZE bytes) and returns its size
+  static size_t encode(const Event& event, uint8_t* out) {
+    auto size = sizeOf(event.type);
+    return encodeFrame(Frame, &event, size ? size : sizeof(Event), out);
+  }
+
+  template <typename M>
+  static size_t encode(const typename M::payload_type& payload, uint8_t* out) {
+    static_assert(contains<M>, "message is not part of this registry");
+    return encode(M::make(payload), out);
+  }
+
+  // copies a frame payload into event if its length fits the type: at least the active member as this build
+  // knows it and at most the whole event, as sent before frames were trimmed or by a build whose member grew.
+  // zero fills what the frame did not carry, like FrameDecoder::payloadAs()
+  static bool decode(const uint8_t* payload, uint8_t len, Event& event) {
+    uint16_t type;
+    if (len < sizeof(type)) {
+      return false;
+    }
+    memcpy(&type, payload, sizeof(type));
+
+    auto size = sizeOf(type);
+    if (!size || len < size || len > sizeof(Event)) {
+      return false;
+    }
+    memset((void*)&event, 0, sizeof(Event));
+    memcpy((void*)&event, payload, len);
+    return true;
+  }
+
+  // calls handlers(M{}, payload) for the message M registered for event.type with a single table lookup.
+  // returns false for types that are not registered or that the handlers do not take
+  template <typename H>
+  static bool dispatch(const Event& event, H&& handlers) {
+    using Handler = std::remove_reference_t<H>;
+    using Thunk = void (*)(const Event&, Handler&);
+
+    static constexpr auto table = []() {
+      std::array<Thunk, EVENT_INDEX_COUNT> table{};
+      (
+        [&]() {
+          if constexpr (std::is_invocable_v<Handler&, Messages, const typename Messages::payload_type&>) {
+            table[eventIndex(Messages::type)] = &call<Messages, Handler>;
+          }
+        }(),
+        ...);
+      return table;
+    }();
+
+    auto index = eventIndex(event.type);
+    if (index >= EVENT_INDEX_COUNT || !table[index]) {
+      return false;
+    }
+    table[index](event, handlers);
+    return true;
+  }
+};
+
+using GamepadMessages = MessageRegistry<FRAME_GAMEPAD_EVENT, GamepadEvent,
+  msg::GetParameter,
+  msg::SetParameter,
+  msg::Channels,
+  msg::Ping,
+  msg::ReadParameterEntries,
+  msg::CrsfChannels,
+  msg::AxisMotion,
+  msg::ButtonDown,
+  msg::ButtonUp>;
+
+using RemoteMessages = MessageRegistry<FRAME_REMOTE_EVENT, RemoteEvent,
+  msg::ReportLinkStats,
+  msg::ReportTelemetry,
+  msg::ReportArmed,
+  msg::ReportParameter,
+  msg::ReportVRXChannel,
+  msg::ReportVRXRSSI,
+  msg::Pong,
+  msg::ReportDeviceInfo,
+  msg::ReportParameterEntry>;
+} // namespace rc
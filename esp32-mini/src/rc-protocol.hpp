@@ -61,10 +61,19 @@ enum Parameter {
   PARAM_VRX_FREQ = 0xC0,
 };
 
+constexpr uint8_t PARAMETER_ENTRIES_PER_READ = 24;
+constexpr uint8_t PARAMETER_ENTRY_SLICE_SIZE = 48;
+
+constexpr uint8_t CRSF_CHANNEL_COUNT = 16;
+
 struct [[gnu::packed]] GamepadEvent {
   enum Type {
     PAD_EVENT_GET_PARAMETER,
     PAD_EVENT_SET_PARAMETER,
+    PAD_EVENT_CHANNELS,
+    PAD_EVENT_PING,
+    PAD_EVENT_READ_PARAMETER_ENTRIES,
+    PAD_EVENT_CRSF_CHANNELS,
     SDL_EVENT_GAMEPAD_AXIS_MOTION = 1616,
     SDL_EVENT_GAMEPAD_BUTTON_DOWN = 1617,
     SDL_EVENT_GAMEPAD_BUTTON_UP = 1618,
@@ -89,6 +98,29 @@ struct [[gnu::packed]] GamepadEvent {
     struct [[gnu::packed]] {
       uint8_t button;
     } button_up;
+    // full stick, trigger and button state of one channel tick, applied as a whole
+    struct [[gnu::packed]] {
+      int16_t axes[SDL_GAMEPAD_AXIS_COUNT];
+      uint32_t buttons; // bit n = SDL_GamepadButton n is pressed
+    } channels;
+    // answered with RC_EVENT_PONG once the channels sent along with it went out on the crsf wire
+    struct [[gnu::packed]] {
+      uint32_t sequence;
+      int64_t sent_at_ns; // host steady_clock
+      uint32_t sample_age_us; // age of the newest stick sample in these channels when sent, UINT32_MAX if none
+    } ping;
+    // whole crsf parameter entries to read, answered with RC_EVENT_REPORT_PARAMETER_ENTRY each.
+    // the bridge reads them back to back, 0 is the root folder
+    struct [[gnu::packed]] {
+      uint8_t count;
+      uint8_t parameters[PARAMETER_ENTRIES_PER_READ];
+    } read_parameter_entries;
+    // channel values shaped on the host, in crsf units. supersedes the axes of PAD_EVENT_CHANNELS,
+    // channels outside the mask keep what the bridge set itself (aux1 is the arm switch)
+    struct [[gnu::packed]] {
+      uint16_t values[CRSF_CHANNEL_COUNT]; // CHANNEL_VALUE_MIN..CHANNEL_VALUE_MAX, 0 is aileron
+      uint16_t mask; // bit n = values[n] is set
+    } crsf_channels;
   };
 };
 
@@ -102,6 +134,9 @@ struct [[gnu::packed]] RemoteEvent {
     RC_EVENT_REPORT_PARAMETER,
     RC_EVENT_REPORT_VRX_CHANNEL,
     RC_EVENT_REPORT_VRX_RSSI,
+    RC_EVENT_PONG,
+    RC_EVENT_REPORT_DEVICE_INFO,
+    RC_EVENT_REPORT_PARAMETER_ENTRY,
   };
 
   uint16_t type;
@@ -121,8 +156,79 @@ struct [[gnu::packed]] RemoteEvent {
     struct [[gnu::packed]] {
       uint8_t percent;
     } report_vrx_rssi;
+    // the PAD_EVENT_PING it answers plus firmware micros() timestamps, for rtt and clock sync
+    struct [[gnu::packed]] {
+      uint32_t sequence;
+      int64_t sent_at_ns;
+      uint32_t sample_age_us;
+      uint32_t received_at_us; // ping decoded
+      uint32_t crsf_written_at_us; // first crsf channels frame after the ping written to the wire
+      uint32_t replied_at_us; // pong written
+    } pong;
+    // identity of the crsf module, sent after every hello from the host and whenever the module answers a ping
+    struct [[gnu::packed]] {
+      uint32_t serial_number;
+      uint32_t hardware_id;
+      uint32_t firmware_id;
+      uint8_t parameters_total;
+      uint8_t parameter_version;
+      char name[16]; // truncated, not null terminated if it fills the array
+    } report_device_info;
+    // one slice of a crsf parameter entry as the module sent it, from the folder byte on
+    struct [[gnu::packed]] {
+      uint8_t parameter;
+      uint16_t offset;
+      uint16_t total; // length of the whole entry, up to the 256 bytes crsf::Transmitter assembles
+      uint8_t len;
+      uint8_t data[PARAMETER_ENTRY_SLICE_SIZE];
+    } report_parameter_entry;
   };
 };
 
 static_assert(sizeof(RemoteEvent) < CDC_PACKET_SIZE);
+
+// bumped whenever the layout of GamepadEvent or RemoteEvent changes in a way older code would mis-parse
+constexpr uint16_t PROTOCOL_VERSION = 1;
+// oldest version this copy of the protocol can still talk to
+constexpr uint16_t PROTOCOL_MIN_VERSION = 1;
+
+enum Feature : uint32_t {
+  // several frames per write, the receiver decodes a stream instead of one frame per usb packet
+  FEATURE_BATCHING = 1 << 0,
+};
+
+enum HelloFlags : uint8_t {
+  // the receiver answers with its own hello
+  HELLO_REQUEST = 1 << 0,
+};
+
+// dense index of a GamepadEvent or RemoteEvent type, the SDL types start at 16
+constexpr uint8_t EVENT_INDEX_COUNT = 32;
+
+constexpr uint32_t eventIndex(uint16_t type) {
+  return type >= GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION ? 16 + type - GamepadEvent::SDL_EVENT_GAMEPAD_AXIS_MOTION : type;
+}
+
+// bit of a GamepadEvent or RemoteEvent type in Hello::accepted_events
+constexpr uint32_t eventBit(uint16_t type) {
+  return eventIndex(type) < EVENT_INDEX_COUNT ? 1u << eventIndex(type) : 0;
+}
+
+// exchanged in FRAME_HELLO frames when the host opens the bridge and when the firmware boots.
+// this layout never changes so both sides can read it whatever their version, everything else is
+// only sent in the encodings both sides accept.
+struct [[gnu::packed]] Hello {
+  uint16_t version;
+  uint16_t min_version;
+  // largest frame payload the sender decodes
+  uint8_t max_payload;
+  uint8_t flags;
+  // eventBit() of every event type the sender decodes, GamepadEvent on the firmware, RemoteEvent on the host
+  uint32_t accepted_events;
+  uint32_t features;
+};
+
+inline bool compatible(const Hello& a, const Hello& b) {
+  return a.min_version <= b.version && b.min_version <= a.version;
+}
 } // namespace rc